@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <string.h>
+
+#include "dataset.h"
+
+/* converts a text data set (and, optionally, its fold file) into the
+ * binary format that the regression program can map directly:
+ *
+ *   convert <data-file> <fold-file> <output-file> [-f]
+ *
+ * where a fold file of "-" means that no folds are stored, and -f
+ * stores the data as floats rather than doubles */
+int main(int argc, char **argv)
+{
+    int i;
+    bool single_precision;
+    struct gges_dataset *d;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <data-file> <fold-file> <output-file> [-f]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    single_precision = false;
+    i = 4; while (i < argc) {
+        if (strncmp(argv[i], "-f", 2) == 0) {
+            single_precision = true;
+            i++;
+        } else {
+            fprintf(stderr, "%s:%d - WARNING: ignoring unknown argument %s\n",
+                    __FILE__, __LINE__, argv[i]);
+            i++;
+        }
+    }
+
+    d = gges_load_dataset(argv[1], (strcmp(argv[2], "-") == 0) ? NULL : argv[2], 1);
+    if (!gges_write_dataset(d, argv[3], single_precision)) {
+        fprintf(stderr, "%s:%d - ERROR: could not write the dataset to %s. Quitting...\n",
+                __FILE__, __LINE__, argv[3]);
+        gges_release_dataset(d);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "%s: %d instances, %d features, %d folds\n",
+            argv[3], d->n_rows, d->n_features, d->n_folds);
+    gges_release_dataset(d);
+
+    return EXIT_SUCCESS;
+}
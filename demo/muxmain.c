@@ -16,7 +16,6 @@
 #include "grammar.h"
 #include "individual.h"
 
-#include "data.h"
 #include "parameters.h"
 
 struct details {
@@ -284,7 +283,7 @@ int main(int argc, char **argv)
     struct gges_population *pop;
     struct gges_parameters *params;
     struct gges_bnf_grammar *G;
-    char bufvar[255];
+    char *grammar_cache = NULL;
 
     struct timeval t;
     gettimeofday(&t, NULL);
@@ -300,12 +299,15 @@ int main(int argc, char **argv)
         if (strncmp(argv[i], "-p", 2) == 0) {
             process_parameter(argv[i + 1], params);
             i += 2;
+        } else if (strncmp(argv[i], "-c", 2) == 0) {
+            grammar_cache = argv[i + 1];
+            i += 2;
         } else {
             parse_parameters(argv[i++], params);
         }
     }
 
-    G = gges_load_bnf(argv[1]);
+    G = gges_load_bnf_cached(argv[1], grammar_cache);
     /* add the features to the grammar, starting from the second
      * variable. The current implementation requires us to
      * "completely" specify the grammar in the source file, meaning
@@ -313,16 +315,11 @@ int main(int argc, char **argv)
      * have to include the first variable in the source file, and then
      * start from the second one */
     if (gges_grammar_has_non_terminal(G, "<bit>")) {
-        for (i = 1; i < details.b; ++i) {
-            sprintf(bufvar, "<bit> ::= b%d", i);
-            gges_extend_grammar(G, bufvar, true);
-        }
+        gges_add_numbered_terminals(G, "<bit>", "b", 1, details.b - 1);
     } else {
-        for (i = 1; i < details.b; ++i) {
-            sprintf(bufvar, "<B> ::= b%d", i);
-            gges_extend_grammar(G, bufvar, true);
-        }
+        gges_add_numbered_terminals(G, "<B>", "b", 1, details.b - 1);
     }
+    gges_relink_grammar(G);
 
     pop = gges_run_system(params, G, eval, NULL, report, &details);
 
@@ -247,13 +247,12 @@ int main(int argc, char **argv)
     struct gges_population *pop;
     struct gges_parameters *params;
     struct gges_bnf_grammar *G;
+    char *grammar_cache = NULL;
 
     struct timeval t;
     gettimeofday(&t, NULL);
     init_genrand(t.tv_usec);
 
-    G = gges_load_bnf(argv[1]);
-
     load_instances(argv[2]);
     params = gges_default_parameters();
     params->rnd = genrand_real2;
@@ -261,11 +260,16 @@ int main(int argc, char **argv)
         if (strncmp(argv[i], "-p", 2) == 0) {
             process_parameter(argv[i + 1], params);
             i += 2;
+        } else if (strncmp(argv[i], "-c", 2) == 0) {
+            grammar_cache = argv[i + 1];
+            i += 2;
         } else {
             parse_parameters(argv[i++], params);
         }
     }
 
+    G = gges_load_bnf_cached(argv[1], grammar_cache);
+
     /* force certain parameters from original work (i.e., ignore config) */
     params->population_size = 50;
     params->generation_count = 50;
@@ -47,12 +47,35 @@ void process_parameter(char *param, struct gges_parameters *params)
         params->init_min_depth = atoi(value);
     } else if (strncmp(key, "init_max_depth", 14) == 0) {
         params->init_max_depth = atoi(value);
+    } else if (strncmp(key, "init_min_size", 13) == 0) {
+        params->init_min_size = atoi(value);
+    } else if (strncmp(key, "init_max_size", 13) == 0) {
+        params->init_max_size = atoi(value);
+    } else if (strncmp(key, "effective_crossover", 19) == 0) {
+        params->effective_crossover = (value[0] == 'Y');
+    } else if (strncmp(key, "tail_prune_slack", 16) == 0) {
+        params->tail_prune_slack = atof(value);
+    } else if (strncmp(key, "codon_bits", 10) == 0) {
+        params->codon_bits = atoi(value);
     } else if (strncmp(key, "init_codon_count", 16) == 0) {
         params->init_codon_count = atoi(value);
+    } else if (strncmp(key, "mutation_method", 15) == 0) {
+        if (strncmp(value, "SUBTREE", 7) == 0) {
+            params->mutation_method = SUBTREE_MUTATION;
+        } else if (strncmp(value, "POINT", 5) == 0) {
+            params->mutation_method = POINT_MUTATION;
+        } else {
+            fprintf(stderr, "ERROR: Unknown value for parameter mutation_method: %s\n", value);
+            exit(EXIT_FAILURE);
+        }
     } else if (strncmp(key, "max_mut_depth", 13) == 0) {
         params->maximum_mutation_depth = atoi(value);
     } else if (strncmp(key, "depth_limit", 11) == 0) {
         params->maximum_tree_depth = atoi(value);
+    } else if (strncmp(key, "size_limit", 10) == 0) {
+        params->maximum_tree_size = atoi(value);
+    } else if (strncmp(key, "length_limit", 12) == 0) {
+        params->maximum_phenotype_length = atoi(value);
     } else if (strncmp(key, "search_method", 13) == 0) {
         if (strncmp(value, "RANDOM", 6) == 0) {
             params->generation_method = RANDOM_SEARCH;
@@ -75,6 +98,10 @@ void process_parameter(char *param, struct gges_parameters *params)
             fprintf(stderr, "ERROR: Unknown value for parameter search_method: %s\n", value);
             exit(EXIT_FAILURE);
         }
+    } else if (strncmp(key, "sge_recursion_depth", 19) == 0) {
+        params->sge_recursion_depth = atoi(value);
+    } else if (strncmp(key, "sge_dynamic_genome", 18) == 0) {
+        params->sge_dynamic_genome = (value[0] == 'Y');
     } else if (strncmp(key, "sensible_init_tail", 18) == 0) {
         params->sensible_init_tail_length = atof(value);
     } else if (strncmp(key, "sensible_init", 13) == 0) {
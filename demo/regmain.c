@@ -15,22 +15,20 @@
 #include "gges.h"
 #include "grammar.h"
 #include "individual.h"
+#include "dataset.h"
 
-#include "data.h"
 #include "parameters.h"
 
-struct data_set_details {
-    int n_features;
-
-    double **train_X;
-    double  *train_Y;
-    int      n_train;
-    double train_mean_rmse;
+/* the number of rows that are evaluated together. Each instruction is
+ * applied to a whole block of rows at a time, which leaves the inner
+ * loops simple enough for the compiler to vectorise */
+#define BLOCK_SIZE 64
 
-    double **test_X;
-    double  *test_Y;
-    int      n_test;
-    double test_mean_rmse;
+struct data_set_details {
+    /* the training and testing rows of the chosen fold, copied into
+     * columns that are padded to a multiple of BLOCK_SIZE rows */
+    struct gges_dataset *train;
+    struct gges_dataset *test;
 };
 
 static double safe_divide(double a, double b)
@@ -53,227 +51,258 @@ static double safe_sqrt(double a)
     return sqrt(fabs(a));
 }
 
-static void push_number(double val, double **stack, int *n, int *s)
-{
-    if (*n >= *s) {
-        while (*s <= *n) *s *= 2;
-        *stack = realloc(*stack, *s * sizeof(double));
-    }
+/* the phenotypes are compiled into a postfix program before they are
+ * run over the data, so that parsing (and the lookup of operators,
+ * constants and variables) is done once per individual rather than
+ * once per fitness case */
+enum opcode {
+    OP_CONST, OP_VAR,
 
-    (*stack)[(*n)++] = val;
-}
+    /* binary operators */
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_SAFE_DIV,
 
-static double pop_number(double *stack, int *n)
-{
-    return ((*n) == 0) ? NAN : stack[--(*n)];
-}
+    /* functions */
+    OP_INV, OP_COS, OP_SIN, OP_TAN, OP_LOG, OP_EXP, OP_SQRT, OP_NEG,
+    OP_POW, OP_PLOG, OP_PDIV, OP_PINV, OP_PEXP, OP_PSQRT,
 
-static void push_op(char *op, char ***stack, int *n, int *s)
-{
-    if (*n >= *s) {
-        while (*s <= *n) *s *= 2;
-        *stack = realloc(*stack, *s * sizeof(char *));
-    }
+    OP_LEFT_BRACKET /* only used while compiling */
+};
 
-    (*stack)[(*n)++] = op;
-}
+struct instruction {
+    enum opcode op;
+    double value; /* the value of a constant */
+    int index;    /* the column of a variable */
+};
 
-static char *peek_op(char **stack, int n)
-{
-    return (n == 0) ? NULL : stack[n - 1];
-}
+struct program {
+    struct instruction *code;
+    int n;
 
-static char *pop_op(char **stack, int *n)
-{
-    return ((*n) == 0) ? NULL : stack[--(*n)];
-}
+    int depth; /* the deepest that the stack gets when running */
+    bool valid; /* false if the phenotype could not be compiled */
+};
 
-static bool is_function(char *token)
+static enum opcode function_opcode(char *token)
 {
-    if (strncmp(token, "inv", 3) == 0) return true;
+    if (strncmp(token, "inv", 3) == 0) return OP_INV;
 
-    if (strncmp(token, "cos", 3) == 0) return true;
-    if (strncmp(token, "sin", 3) == 0) return true;
-    if (strncmp(token, "tan", 3) == 0) return true;
-    if (strncmp(token, "log", 3) == 0) return true;
-    if (strncmp(token, "exp", 3) == 0) return true;
-    if (strncmp(token, "sqrt", 4) == 0) return true;
+    if (strncmp(token, "cos", 3) == 0) return OP_COS;
+    if (strncmp(token, "sin", 3) == 0) return OP_SIN;
+    if (strncmp(token, "tan", 3) == 0) return OP_TAN;
+    if (strncmp(token, "log", 3) == 0) return OP_LOG;
+    if (strncmp(token, "exp", 3) == 0) return OP_EXP;
+    if (strncmp(token, "sqrt", 4) == 0) return OP_SQRT;
 
-    if (strncmp(token, "neg", 3) == 0) return true;
-    if (strncmp(token, "pow", 3) == 0) return true;
+    if (strncmp(token, "neg", 3) == 0) return OP_NEG;
+    if (strncmp(token, "pow", 3) == 0) return OP_POW;
 
-    if (strncmp(token, "plog", 4) == 0) return true;
-    if (strncmp(token, "pdiv", 4) == 0) return true;
-    if (strncmp(token, "pinv", 4) == 0) return true;
-    if (strncmp(token, "pexp", 4) == 0) return true;
-    if (strncmp(token, "psqrt", 5) == 0) return true;
+    if (strncmp(token, "plog", 4) == 0) return OP_PLOG;
+    if (strncmp(token, "pdiv", 4) == 0) return OP_PDIV;
+    if (strncmp(token, "pinv", 4) == 0) return OP_PINV;
+    if (strncmp(token, "pexp", 4) == 0) return OP_PEXP;
+    if (strncmp(token, "psqrt", 5) == 0) return OP_PSQRT;
 
-    return false;
+    return OP_CONST; /* not a function */
 }
 
-static double function(char *token, double *output, int *n_o)
+static enum opcode operator_opcode(char *token)
 {
-    if (strncmp(token, "inv", 3) == 0) return 1 / pop_number(output, n_o);
-
-    if (strncmp(token, "cos", 3) == 0) return cos(pop_number(output, n_o));
-    if (strncmp(token, "sin", 3) == 0) return sin(pop_number(output, n_o));
-    if (strncmp(token, "tan", 3) == 0) return tan(pop_number(output, n_o));
-    if (strncmp(token, "log", 3) == 0) return log(pop_number(output, n_o));
-    if (strncmp(token, "exp", 3) == 0) return exp(pop_number(output, n_o));
-    if (strncmp(token, "sqrt", 4) == 0) return sqrt(pop_number(output, n_o));
-
-    if (strncmp(token, "neg", 3) == 0) return -(pop_number(output, n_o));
-    if (strncmp(token, "pow", 3) == 0) return pow(pop_number(output, n_o), pop_number(output, n_o));
-
-    if (strncmp(token, "plog", 4) == 0) return safe_log(pop_number(output, n_o));
-    if (strncmp(token, "pdiv", 4) == 0) return safe_divide(pop_number(output, n_o), pop_number(output, n_o));
-    if (strncmp(token, "pinv", 4) == 0) return safe_divide(1, pop_number(output, n_o));
-    if (strncmp(token, "pexp", 4) == 0) return safe_exp(pop_number(output, n_o));
-    if (strncmp(token, "psqrt", 5) == 0) return safe_sqrt(pop_number(output, n_o));
-
-    fprintf(stderr, "WARNING: skipping unknown function: %s\n", token);
+    if (strncmp(token, "+", 1) == 0) return OP_ADD;
+    if (strncmp(token, "-", 1) == 0) return OP_SUB;
+    if (strncmp(token, "*", 1) == 0) return OP_MUL;
+    if (strncmp(token, "/", 1) == 0) return OP_DIV;
+    if (strncmp(token, "%", 1) == 0) return OP_MOD;
+    if (strncmp(token, "÷", 1) == 0) return OP_SAFE_DIV;
+
+    return OP_CONST; /* not an operator */
+}
 
-    return NAN;
+static bool is_operator(enum opcode op)
+{
+    return (op >= OP_ADD) && (op <= OP_SAFE_DIV);
 }
 
-static bool is_operator(char *token)
+static bool is_function(enum opcode op)
 {
-    if (strncmp(token, "+", 1) == 0) return true;
-    if (strncmp(token, "-", 1) == 0) return true;
-    if (strncmp(token, "*", 1) == 0) return true;
-    if (strncmp(token, "/", 1) == 0) return true;
-    if (strncmp(token, "%", 1) == 0) return true;
-    if (strncmp(token, "÷", 1) == 0) return true;
-
-    return false;
+    return (op >= OP_INV) && (op <= OP_PSQRT);
 }
 
-static int operator_precedence(char *token)
+static int operator_precedence(enum opcode op)
 {
-    if (strncmp(token, "+", 1) == 0) return 1;
-    if (strncmp(token, "-", 1) == 0) return 1;
-    if (strncmp(token, "*", 1) == 0) return 2;
-    if (strncmp(token, "/", 1) == 0) return 2;
-    if (strncmp(token, "%", 1) == 0) return 2;
-    if (strncmp(token, "÷", 1) == 0) return 2;
+    return ((op == OP_ADD) || (op == OP_SUB)) ? 1 : 2;
+}
 
+/* the number of values that the instruction takes off the stack */
+static int arity(enum opcode op)
+{
+    if (is_operator(op) || (op == OP_POW) || (op == OP_PDIV)) return 2;
+    if (is_function(op)) return 1;
     return 0;
 }
 
-static double operator(char *token, double a, double b)
+static void emit(struct program *p, enum opcode op, double value, int index, int *depth)
 {
-    if (strncmp(token, "+", 1) == 0) return a + b;
-    if (strncmp(token, "-", 1) == 0) return a - b;
-    if (strncmp(token, "*", 1) == 0) return a * b;
-    if (strncmp(token, "/", 1) == 0) return a / b;
-    if (strncmp(token, "%", 1) == 0) return fmod(a, b);
-    if (strncmp(token, "÷", 1) == 0) return safe_divide(a, b);
-
-    fprintf(stderr, "WARNING: skipping unknown operator: %s\n", token);
-
-    return NAN;
+    if (*depth < arity(op)) p->valid = false;
+    *depth += 1 - arity(op);
+    if (*depth > p->depth) p->depth = *depth;
+
+    p->code[p->n].op = op;
+    p->code[p->n].value = value;
+    p->code[p->n].index = index;
+    p->n++;
 }
 
-static double execute(char *buffer, double *x)
+/* converts the (infix) phenotype into a postfix program, by way of
+ * the shunting-yard algorithm */
+static void compile(char *phenotype, struct program *p)
 {
-    char *token, **ops, *o1, *o2;
-    double *output, res;
-    int n_o, n_q, sz_o, sz_q;;
-
-    sz_o = 8192;
-    sz_q = 8192;
-    ops = malloc(sz_q * sizeof(char *));
-    output = malloc(sz_o * sizeof(double));
-    n_o = n_q = 0;
-
-
-    for (token = strtok(buffer, " "); token; token = strtok(NULL, " ")) {
+    char *buffer, *token;
+    enum opcode *ops, op;
+    int n_ops, depth;
+
+    buffer = malloc(strlen(phenotype) + 1);
+    strcpy(buffer, phenotype);
+
+    /* a program never has more instructions (or pending operators)
+     * than the phenotype has tokens */
+    p->code = malloc((strlen(phenotype) / 2 + 1) * sizeof(struct instruction));
+    ops = malloc((strlen(phenotype) / 2 + 1) * sizeof(enum opcode));
+    p->n = p->depth = 0;
+    p->valid = true;
+
+    n_ops = depth = 0;
+    for (token = strtok(buffer, " "); token && p->valid; token = strtok(NULL, " ")) {
         if (strncmp(token, "x", 1) == 0) {
-            push_number(x[atoi(token + 1) - 1], &output, &n_o, &sz_o);
-        } else if (is_function(token)) {
-            push_op(token, &ops, &n_q, &sz_q);
-        } else if (strncmp(token, ",", 1) == 0) {
-            while (strncmp(peek_op(ops, n_q), "(", 1) != 0) {
-                token = pop_op(ops, &n_q);
-                if (is_operator(token)) {
-                    push_number(operator(token, pop_number(output, &n_o), pop_number(output, &n_o)), &output, &n_o, &sz_o);
-                } else {
-                    push_number(function(token, output, &n_o), &output, &n_o, &sz_o);
-                }
+            emit(p, OP_VAR, 0, atoi(token + 1) - 1, &depth);
+        } else if (is_function(op = function_opcode(token))) {
+            ops[n_ops++] = op;
+        } else if ((strncmp(token, ",", 1) == 0) || (strncmp(token, ")", 1) == 0)) {
+            while ((n_ops > 0) && (ops[n_ops - 1] != OP_LEFT_BRACKET)) {
+                emit(p, ops[--n_ops], 0, 0, &depth);
             }
-        } else if (is_operator(token)) {
-            o1 = token;
-            while (peek_op(ops, n_q) && is_operator(peek_op(ops, n_q))) {
-                o2 = peek_op(ops, n_q);
-                if (operator_precedence(o1) <= operator_precedence(o2)) {
-                    push_number(operator(pop_op(ops, &n_q), pop_number(output, &n_o), pop_number(output, &n_o)), &output, &n_o, &sz_o);
-                } else {
-                    break;
+            if (n_ops == 0) {
+                p->valid = false;
+            } else if (token[0] == ')') {
+                n_ops--; /* pop the left bracket */
+                if ((n_ops > 0) && is_function(ops[n_ops - 1])) {
+                    emit(p, ops[--n_ops], 0, 0, &depth);
                 }
             }
-            push_op(o1, &ops, &n_q, &sz_q);
-        } else if (strncmp(token, "(", 1) == 0) {
-            push_op(token, &ops, &n_q, &sz_q);
-        } else if (strncmp(token, ")", 1) == 0) {
-            while (strncmp(peek_op(ops, n_q), "(", 1) != 0) {
-                token = pop_op(ops, &n_q);
-                if (is_operator(token)) {
-                    push_number(operator(token, pop_number(output, &n_o), pop_number(output, &n_o)), &output, &n_o, &sz_o);
-                } else {
-                    push_number(function(token, output, &n_o), &output, &n_o, &sz_o);
-                }
-            }
-
-            token = pop_op(ops, &n_q); /* pop the left bracket */
-
-            if (peek_op(ops, n_q) && is_function(peek_op(ops, n_q))) {
-                push_number(function(pop_op(ops, &n_q), output, &n_o), &output, &n_o, &sz_o);
+        } else if (is_operator(op = operator_opcode(token))) {
+            while ((n_ops > 0) && is_operator(ops[n_ops - 1])
+                   && (operator_precedence(op) <= operator_precedence(ops[n_ops - 1]))) {
+                emit(p, ops[--n_ops], 0, 0, &depth);
             }
+            ops[n_ops++] = op;
+        } else if (strncmp(token, "(", 1) == 0) {
+            ops[n_ops++] = OP_LEFT_BRACKET;
         } else {
-            push_number(atof(token), &output, &n_o, &sz_o);
+            emit(p, OP_CONST, atof(token), 0, &depth);
         }
     }
 
-    while ((token = pop_op(ops, &n_q))) {
-        if (is_operator(token)) {
-            push_number(operator(token, pop_number(output, &n_o), pop_number(output, &n_o)), &output, &n_o, &sz_o);
+    while (p->valid && (n_ops > 0)) {
+        op = ops[--n_ops];
+        if (op == OP_LEFT_BRACKET) {
+            p->valid = false;
         } else {
-            push_number(function(token, output, &n_o), &output, &n_o, &sz_o);
+            emit(p, op, 0, 0, &depth);
         }
     }
+    if (depth == 0) p->valid = false;
 
-    res = output[0];
-
-    free(output);
     free(ops);
+    free(buffer);
+}
 
-    return res;
+/* runs the program against a block of BLOCK_SIZE fitness cases,
+ * starting at the given row, leaving the predictions at the bottom of
+ * the stack (which holds BLOCK_SIZE values per level) */
+static void run_block(struct program *p, double **columns, int row, double *stack)
+{
+    int i, j, n;
+    double *a, *b;
+    struct instruction *c;
+
+    n = 0;
+    for (i = 0; i < p->n; ++i) {
+        c = p->code + i;
+        n += 1 - arity(c->op);
+        a = stack + (n - 1) * BLOCK_SIZE;
+        b = a + BLOCK_SIZE;
+
+        switch (c->op) {
+        case OP_CONST:
+            for (j = 0; j < BLOCK_SIZE; ++j) a[j] = c->value;
+            break;
+        case OP_VAR:
+            memcpy(a, columns[c->index] + row, BLOCK_SIZE * sizeof(double));
+            break;
+
+        case OP_ADD:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = a[j] + b[j]; break;
+        case OP_SUB:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = a[j] - b[j]; break;
+        case OP_MUL:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = a[j] * b[j]; break;
+        case OP_DIV:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = a[j] / b[j]; break;
+        case OP_MOD:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = fmod(a[j], b[j]); break;
+        case OP_SAFE_DIV: for (j = 0; j < BLOCK_SIZE; ++j) a[j] = safe_divide(a[j], b[j]); break;
+
+        case OP_INV:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = 1 / a[j]; break;
+        case OP_COS:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = cos(a[j]); break;
+        case OP_SIN:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = sin(a[j]); break;
+        case OP_TAN:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = tan(a[j]); break;
+        case OP_LOG:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = log(a[j]); break;
+        case OP_EXP:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = exp(a[j]); break;
+        case OP_SQRT:     for (j = 0; j < BLOCK_SIZE; ++j) a[j] = sqrt(a[j]); break;
+        case OP_NEG:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = -a[j]; break;
+        case OP_POW:      for (j = 0; j < BLOCK_SIZE; ++j) a[j] = pow(a[j], b[j]); break;
+        case OP_PLOG:     for (j = 0; j < BLOCK_SIZE; ++j) a[j] = safe_log(a[j]); break;
+        case OP_PDIV:     for (j = 0; j < BLOCK_SIZE; ++j) a[j] = safe_divide(a[j], b[j]); break;
+        case OP_PINV:     for (j = 0; j < BLOCK_SIZE; ++j) a[j] = safe_divide(1, a[j]); break;
+        case OP_PEXP:     for (j = 0; j < BLOCK_SIZE; ++j) a[j] = safe_exp(a[j]); break;
+        case OP_PSQRT:    for (j = 0; j < BLOCK_SIZE; ++j) a[j] = safe_sqrt(a[j]); break;
+
+        case OP_LEFT_BRACKET: break;
+        }
+    }
 }
 
-static double measure_rmse(struct gges_individual *ind, double **X, double *Y, int n)
+static double measure_rmse(struct gges_individual *ind, struct gges_dataset *data)
 {
-    int i;
-    double y, yhat;
-    double residual, mse;
-    char *buffer;
+    int i, j, m, n;
+    double residual, sse[BLOCK_SIZE];
+    double *Y, *stack;
+    struct program p;
 
     if (!ind->mapped) return DBL_MAX - 1.0;
 
-    mse = 0;
-    buffer = malloc(strlen(ind->mapping->buffer) + 1);
-    for (i = 0; i < n; ++i) {
-        strcpy(buffer, ind->mapping->buffer);
+    compile(ind->mapping->buffer, &p);
+    if (!p.valid) {
+        free(p.code);
+        return DBL_MAX - 1.0;
+    }
 
-        y    = Y[i];
-        yhat = execute(buffer, X[i]);
-        residual = y - yhat;
+    /* the squared errors are accumulated per lane, and only summed
+     * once all the blocks have been run */
+    for (j = 0; j < BLOCK_SIZE; ++j) sse[j] = 0;
 
-        mse += ((residual * residual) - mse) / (i + 1);
+    n = data->n_rows;
+    Y = data->columns[data->n_features];
+    stack = malloc(p.depth * BLOCK_SIZE * sizeof(double));
+    for (i = 0; i < n; i += BLOCK_SIZE) {
+        run_block(&p, data->columns, i, stack);
 
+        m = (n - i < BLOCK_SIZE) ? (n - i) : BLOCK_SIZE;
+        for (j = 0; j < m; ++j) {
+            residual = Y[i + j] - stack[j];
+            sse[j] += residual * residual;
+        }
     }
-    free(buffer);
+    free(stack);
+    free(p.code);
+
+    for (j = 1; j < BLOCK_SIZE; ++j) sse[0] += sse[j];
 
-    return isfinite(mse) ? sqrt(mse) : (DBL_MAX - 1.0);
+    return (isfinite(sse[0]) && (n > 0)) ? sqrt(sse[0] / n) : (DBL_MAX - 1.0);
 }
 
 static double eval(struct gges_parameters *params __attribute__((unused)),
@@ -283,7 +312,7 @@ static double eval(struct gges_parameters *params __attribute__((unused)),
 
     data = args;
 
-    ind->objective = measure_rmse(ind, data->train_X, data->train_Y, data->n_train);
+    ind->objective = measure_rmse(ind, data->train);
 
     return 1 / (1 + ind->objective);
 }
@@ -305,13 +334,13 @@ static void report(struct gges_parameters *params __attribute__((unused)),
     invalid = 0;
     for (i = 0; i < N; ++i) if (!members[i]->mapped) invalid++;
 
-    best_train = measure_rmse(members[0], details->train_X, details->train_Y, details->n_train);
-    best_test  = measure_rmse(members[0], details->test_X, details->test_Y, details->n_test);
+    best_train = measure_rmse(members[0], details->train);
+    best_test  = measure_rmse(members[0], details->test);
 
     fprintf(stdout, "%4d %10f %10f %10f %10f %d\n", G,
             best_train, best_test,
-            best_train / details->train_mean_rmse,
-            best_test / details->test_mean_rmse,
+            best_train / details->train->mean_rmse,
+            best_test / details->test->mean_rmse,
             invalid);
     fflush(stdout);
 }
@@ -320,21 +349,22 @@ int main(int argc, char **argv)
 {
     int i;
 
+    struct gges_dataset *data;
     struct data_set_details details;
     struct gges_population *pop;
     struct gges_parameters *params;
     struct gges_bnf_grammar *G;
-    char bufvar[255];
+    char *grammar_cache = NULL;
 
     struct timeval t;
     gettimeofday(&t, NULL);
     init_genrand(t.tv_usec);
 
-    load_fold(argv[2], argv[3], atoi(argv[4]),
-              &(details.train_X), &(details.train_Y), &(details.n_train),
-              &(details.test_X), &(details.test_Y), &(details.n_test),
-              &(details.n_features),
-              &(details.train_mean_rmse), &(details.test_mean_rmse));
+    /* a fold file of "-" uses the folds stored in a binary data file */
+    data = gges_load_dataset(argv[2], (strcmp(argv[3], "-") == 0) ? NULL : argv[3], 1);
+    details.train = gges_dataset_fold(data, atoi(argv[4]) - 1, false, BLOCK_SIZE);
+    details.test  = gges_dataset_fold(data, atoi(argv[4]) - 1, true, BLOCK_SIZE);
+    gges_release_dataset(data);
 
     params = gges_default_parameters();
     params->rnd = genrand_real2;
@@ -342,6 +372,9 @@ int main(int argc, char **argv)
         if (strncmp(argv[i], "-p", 2) == 0) {
             process_parameter(argv[i + 1], params);
             i += 2;
+        } else if (strncmp(argv[i], "-c", 2) == 0) {
+            grammar_cache = argv[i + 1];
+            i += 2;
         } else if (access(argv[i], F_OK) != -1) {
             parse_parameters(argv[i++], params);
         } else {
@@ -349,7 +382,7 @@ int main(int argc, char **argv)
         }
     }
 
-    G = gges_load_bnf(argv[1]);
+    G = gges_load_bnf_cached(argv[1], grammar_cache);
     /* add the features to the grammar, starting from the second
      * variable. The current implementation requires us to
      * "completely" specify the grammar in the source file, meaning
@@ -357,16 +390,11 @@ int main(int argc, char **argv)
      * have to include the first variable in the source file, and then
      * start from the second one */
     if (gges_grammar_has_non_terminal(G, "<var>")) {
-        for (i = 2; i <= details.n_features; ++i) {
-            sprintf(bufvar, "<var> ::= x%d", i);
-            gges_extend_grammar(G, bufvar, true);
-        }
+        gges_add_numbered_terminals(G, "<var>", "x", 2, details.train->n_features);
     } else {
-        for (i = 1; i <= details.n_features; ++i) {
-            sprintf(bufvar, "<expr> ::= x%d", i);
-            gges_extend_grammar(G, bufvar, true);
-        }
+        gges_add_numbered_terminals(G, "<expr>", "x", 1, details.train->n_features);
     }
+    gges_relink_grammar(G);
 
     pop = gges_run_system(params, G, eval, NULL, report, &details);
 
@@ -374,7 +402,8 @@ int main(int argc, char **argv)
     free(params);
     gges_release_grammar(G);
 
-    unload_data(details.train_X, details.train_Y, details.test_X, details.test_Y);
+    gges_release_dataset(details.train);
+    gges_release_dataset(details.test);
 
     return EXIT_SUCCESS;
 }
@@ -74,6 +74,7 @@ int main(int argc, char **argv)
     struct gges_population *pop;
     struct gges_parameters *params;
     struct gges_bnf_grammar *G;
+    char *grammar_cache = NULL;
 
     struct timeval t;
     gettimeofday(&t, NULL);
@@ -85,12 +86,15 @@ int main(int argc, char **argv)
         if (strncmp(argv[i], "-p", 2) == 0) {
             process_parameter(argv[i + 1], params);
             i += 2;
+        } else if (strncmp(argv[i], "-c", 2) == 0) {
+            grammar_cache = argv[i + 1];
+            i += 2;
         } else {
             parse_parameters(argv[i++], params);
         }
     }
 
-    G = gges_load_bnf(argv[1]);
+    G = gges_load_bnf_cached(argv[1], grammar_cache);
 
     pop = gges_run_system(params, G, eval, NULL, report, NULL);
 
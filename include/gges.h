@@ -0,0 +1,200 @@
+#ifndef GGES_SYSTEM
+#define GGES_SYSTEM
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    #include <stdbool.h>
+
+    struct gges_individual;
+    struct gges_population;
+    struct gges_bnf_grammar;
+    struct gges_parameters;
+    struct gges_sge_layout;
+
+    enum gges_model_type { CONTEXT_FREE_GP, GRAMMATICAL_EVOLUTION, STRUCTURED_GRAMMATICAL_EVOLUTION };
+    enum gges_generation_method { RANDOM_SEARCH, GENERATIONAL, STEADY_STATE, CUSTOM };
+    enum gges_cfggp_node_selection { PICK_NODE_UNIFORM_RANDOM, PICK_NODE_KOZA_90_10, PICK_NODE_DEPTH_PROP };
+    enum gges_cfggp_mutation_method { SUBTREE_MUTATION, POINT_MUTATION };
+
+    typedef void (*GGES_BEFORE_GENERATION)(struct gges_parameters *, int,
+                                           struct gges_individual **, int,
+                                           void *);
+
+    typedef void (*GGES_AFTER_GENERATION)(struct gges_parameters *, int,
+                                          struct gges_individual **, int,
+                                          void *);
+
+    typedef double (*GGES_EVAL)(struct gges_parameters *,
+                                struct gges_individual *,
+                                void *);
+
+    typedef bool (*GGES_ITERATION)(struct gges_parameters *,
+                                   struct gges_bnf_grammar *,
+                                   GGES_EVAL,
+                                   struct gges_population *,
+                                   struct gges_population *,
+                                   void *);
+
+    struct gges_parameters {
+        enum gges_model_type model;
+
+        /* global parameters, regardless of representation */
+        int population_size;
+        int generation_count;
+
+        enum gges_generation_method generation_method;
+        double elitism_factor; /* if this is less than 1, then this is
+                                * the proportion of the population
+                                * (sorted by fitness) that is carried
+                                * into the next generation
+                                * unchanged. If this is >= 1, then it
+                                * is the exact number of individuals
+                                * from the previous generation carried
+                                * unchanged into the new generation */
+
+        bool cache_fitness;
+
+        int tournament_size;
+
+        enum gges_cfggp_node_selection node_selection_method;
+        double crossover_rate;
+        double mutation_rate;
+
+        bool sensible_initialisation;
+
+        int init_min_depth;
+        int init_max_depth;
+
+        /* if init_max_size is greater than zero, then CFG-GP and GE
+         * individuals are instead initialised by sampling uniformly
+         * from the derivations with a size (number of non-terminal
+         * expansions) in [init_min_size, init_max_size] */
+        int init_min_size;
+        int init_max_size;
+
+        /* Grammatical Evolution-specific parameters */
+        int init_codon_count_min;
+        int init_codon_count;
+
+        double sensible_init_tail_length;
+
+        int mapping_wrap_count;
+
+        int codon_bits; /* the number of bits used to store each
+                         * codon (8, 16 or 32). If zero, then
+                         * gges_run_system picks the smallest that
+                         * can select every production of the
+                         * grammar */
+        int codon_width; /* the width (in bytes) of the codons that
+                          * gges_run_system chose from codon_bits and
+                          * the grammar, and that new individuals are
+                          * created with (zero, the default, means a
+                          * full int) */
+
+        int maximum_phenotype_length; /* the longest (in characters)
+                                       * phenotype that an individual
+                                       * can map to - anything longer
+                                       * is treated as unmapped (and
+                                       * so is never evaluated). This
+                                       * applies to all
+                                       * representations, and is
+                                       * disabled if <= 0 */
+
+        bool fixed_point_crossover;
+
+        bool effective_crossover; /* if true, GE crossover sites are
+                                   * only picked from within the
+                                   * coding regions of the parents */
+
+        double tail_prune_slack; /* if not negative, then the
+                                  * non-coding tail of a GE genome is
+                                  * cut back after mapping, so that it
+                                  * is at most this proportion of the
+                                  * coding region (or one codon, if
+                                  * that is larger) */
+
+        /* CFG-GP-specific parameters */
+        enum gges_cfggp_mutation_method mutation_method; /* point
+                                                          * mutation
+                                                          * falls back
+                                                          * to subtree
+                                                          * mutation if
+                                                          * the chosen
+                                                          * node has no
+                                                          * alternative
+                                                          * production */
+        int maximum_mutation_depth;
+        int maximum_tree_depth;
+        int maximum_tree_size; /* the largest number of nodes allowed
+                                * in an offspring tree, offspring
+                                * that would exceed this are replaced
+                                * by their parents. Disabled if <= 0 */
+
+        /* Structured GE-specific parameters (mainly for
+         * initialisation of the representation), these are filled in
+         * from the grammar by gges_run_system if left as NULL */
+        int *sge_gene_sizes;
+        int sge_genome_size;
+        struct gges_sge_layout *sge_layout; /* the arrangement of the
+                                             * genes, shared by every
+                                             * fixed-size genome */
+
+        int sge_recursion_depth; /* if greater than zero, SGE runs use
+                                  * a copy of the grammar with its
+                                  * recursion unrolled to this depth
+                                  * (see gges_unroll_grammar), so
+                                  * recursive grammars can be used
+                                  * directly (the final population
+                                  * holds the copy, see below) */
+
+        bool sge_dynamic_genome; /* if true, SGE genomes start empty
+                                  * and grow as mapping needs them,
+                                  * keeping only the values used in
+                                  * mapping (rather than being sized
+                                  * for the worst case derivation) */
+
+        GGES_EVAL eval;
+
+        GGES_BEFORE_GENERATION before_gen;
+        GGES_AFTER_GENERATION after_gen;
+
+        GGES_ITERATION iteration;
+
+        double (*rnd)(void);
+    };
+
+    struct gges_population {
+        int N;
+
+        struct gges_individual **members;
+
+        int *sge_genes; /* if not NULL, the matrix holding the genomes
+                         * of the (SGE) members */
+
+        /* the grammar that the members were derived from, which is
+         * the one to decode them with. This is the grammar given to
+         * gges_run_system, unless the run unrolled it for SGE (see
+         * sge_recursion_depth), in which case the unrolled grammar
+         * belongs to the population, and is released with it */
+        struct gges_bnf_grammar *grammar;
+        bool owns_grammar;
+    };
+
+    struct gges_parameters *gges_default_parameters(void);
+
+    struct gges_population *gges_run_system(struct gges_parameters *params,
+                                            struct gges_bnf_grammar *grammar,
+                                            GGES_EVAL evaluator,
+                                            GGES_BEFORE_GENERATION before_gen,
+                                            GGES_AFTER_GENERATION after_gen,
+                                            void *args);
+
+    void gges_release_population(struct gges_population *pop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
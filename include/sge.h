@@ -0,0 +1,169 @@
+#ifndef GGES_SGE
+#define GGES_SGE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    #include <stdbool.h>
+    #include <limits.h>
+
+    #include "grammar.h"
+    #include "derivation.h"
+    #include "mapping.h"
+
+    /* the arrangement of the genes in a fixed-size SGE genome only
+     * depends on the grammar, so one copy of it is shared (and
+     * reference counted) by all of the genomes of a run */
+    struct gges_sge_layout {
+        int n_genes;
+        int *gene_offset;
+        int total_size;
+
+        int refs;
+    };
+
+    struct gges_sge_genome {
+        /* SGE uses a fixed-length representation (the length of this
+         * is determined by analysing the grammar), but maintains
+         * information about the structure of the representation (it
+         * is effectively an array of genes, with each gene a list of
+         * instructions the inform the mapping process) to ensure that
+         * nothing bad happens during the mapping process
+         *
+         * here, we model this as a single dimension integer array,
+         * and note the offset of each gene in this array. When
+         * mapping the genome into a derivation tree, we'll use this
+         * offset to properly index the required value for
+         * production */
+        int *genes;
+
+        int n_genes;      /* this should always be equal to the number
+                           * of non-terminals in the grammar. However,
+                           * we keep a copy of it just in case we need
+                           * to perform an operation on the
+                           * representation and the grammar has not
+                           * been provided (e.g., crossover) */
+
+        int *gene_offset; /* where does each gene start in the
+                           * genome? */
+
+        struct gges_sge_layout *layout; /* if not NULL, gene_offset
+                                         * belongs to this shared
+                                         * layout rather than the
+                                         * genome */
+
+        int *gene_size;   /* how many elements in the gene were used
+                           * to map the individual? */
+
+        int total_size;   /* the total size of the genome (the
+                           * cumulative sum of the length of the list
+                           * of each gene in the genome) */
+
+        int capacity;     /* the allocated length of genes */
+
+        bool borrowed;    /* true if genes is a row of a population
+                           * matrix (see gges_sge_create_genome_matrix)
+                           * and so is not freed with the genome */
+
+        double (*rnd)(void); /* if not NULL, the genome is dynamic:
+                              * rather than being sized for the worst
+                              * case, each gene is extended with new
+                              * random values (drawn from rnd) when
+                              * mapping runs off its end, and is
+                              * trimmed back to the used values once
+                              * mapping succeeds. The genes are then
+                              * no longer at the same offsets in every
+                              * genome, so these never use a shared
+                              * layout */
+
+    };
+
+    /* walks the provided grammar to establish the required genome
+     * size for each individual (and the size of the list required
+     * each gene). Modifies the array passed in through gene_sizes and
+     * returns the total length of the genome
+     *
+     * This uses a different approach than specified in the GP&EM
+     * paper on SGE, as the algorithms in that paper contain a few
+     * errors that make them difficult to implement correctly. The
+     * method used here establishes the upper bound on the number of
+     * times a non-terminal will eventually be used in a derivation,
+     * by dynamic programming over the grammar in topological order
+     * (so each non-terminal costs one pass over the grammar). The
+     * result is kept on the grammar, so later calls just copy it
+     */
+    int gges_sge_compute_gene_sizes(struct gges_bnf_grammar *g,
+                                    int **gene_sizes);
+
+    /* creates a layout for genes of the given sizes, with a single
+     * reference held by the caller */
+    struct gges_sge_layout *gges_sge_create_layout(int n_genes, int *gene_sizes);
+    void gges_sge_release_layout(struct gges_sge_layout *layout);
+
+    struct gges_sge_genome *gges_sge_create_genome(void);
+    void gges_sge_release_genome(struct gges_sge_genome *genome);
+
+    /* allocates a single contiguous matrix with one row of the layout
+     * for each of the n genomes, and hands each genome its row (and
+     * a reference to the layout). Keeping a population's genomes
+     * together like this saves an allocation per individual and
+     * keeps breeding within one block of memory. The matrix is
+     * returned, and must be freed by the caller after the genomes
+     * have been released */
+    int *gges_sge_create_genome_matrix(struct gges_sge_layout *layout,
+                                       struct gges_sge_genome **genomes,
+                                       int n);
+
+
+    /* runs the process that maps the genome into the corresponding
+     * executable code via the supplied grammar
+     *
+     * returns true to indicate that the mapping was successful, which
+     * it will always be in the case of SGE, unless max_length is
+     * greater than zero and the phenotype is longer than max_length
+     * characters */
+    bool gges_sge_map_genome(struct gges_bnf_grammar *g,
+                             struct gges_sge_genome *genome,
+                             struct gges_mapping *mapping,
+                             int max_length);
+
+    struct gges_derivation_tree *gges_sge_derive(struct gges_bnf_grammar *g,
+                                                 struct gges_sge_genome *genome);
+
+    /* uses information from the grammar (specifically, the number of
+     * times a non-terminal is used, against the number of productions
+     * against that non-terminal, as held by the layout) to initialise
+     * the genome. The last parameter is a pseudorandom number
+     * generator function pointer that returns values in [0,1)
+     *
+     * if layout is NULL, then the genome is made dynamic and starts
+     * with every gene empty, so it is filled in by the first mapping
+     * of the genome */
+    bool gges_sge_random_init(struct gges_bnf_grammar *g,
+                              struct gges_sge_genome *genome,
+                              struct gges_sge_layout *layout,
+                              double (*rnd)(void));
+
+    void gges_sge_reproduction(struct gges_sge_genome *p,
+                              struct gges_sge_genome *o);
+
+    /* breeds the offspring d and s from the parents m and f. Neutral
+     * offspring (those that only differ from their first parent in
+     * values that were not expressed in that parent's mapping, and
+     * so map exactly as that parent does) are flagged through
+     * d_neutral and s_neutral */
+    void gges_sge_breed(struct gges_bnf_grammar *g,
+                        struct gges_sge_genome *m,
+                        struct gges_sge_genome *f,
+                        struct gges_sge_genome *d,
+                        struct gges_sge_genome *s,
+                        double pc, double pm,
+                        double (*rnd)(void),
+                        bool *d_neutral, bool *s_neutral);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,20 +7,56 @@
 
 #include "alloc.h"
 
+/* the number of derivations drawn by sized initialisation before it
+ * gives up on finding one within the depth limit */
+#define SIZED_INIT_ATTEMPTS 100
+
+
+
+
+/*******************************************************************************
+ * internal structures
+ ******************************************************************************/
+/* the location of a node within a tree. As subtrees can be shared
+ * between trees, nodes do not know their parents, so the location is
+ * recorded as the path of nodes taken from the root to reach the
+ * node */
+struct tree_site {
+    int level;                      /* the number of nodes on the
+                                     * path, i.e., the distance of the
+                                     * node from the root (the root is
+                                     * at level 1) */
+
+    struct gges_cfggp_node **nodes; /* the nodes on the path, nodes[0]
+                                     * is the root of the tree, and
+                                     * nodes[level - 1] is the located
+                                     * node */
+
+    int *branch;                    /* the index of nodes[i + 1]
+                                     * within the children of
+                                     * nodes[i] */
+};
+
+
+
 
 
 
 /*******************************************************************************
  * internal helper function prototypes
  ******************************************************************************/
-static struct gges_cfggp_node *replicate_tree(struct gges_cfggp_node *t);
+static struct gges_cfggp_node *share_tree(struct gges_cfggp_node *t);
+
+static struct gges_cfggp_node *copy_node(struct gges_cfggp_node *t);
 
-static void map_sequence(struct gges_mapping *mapping,
-                         struct gges_cfggp_node *t);
+static bool map_sequence(struct gges_mapping *mapping,
+                         struct gges_cfggp_node *t, int max_length);
 
 static struct gges_derivation_tree *map_derivation(struct gges_cfggp_node *t);
 
-static void calculate_depths(struct gges_cfggp_node *t);
+static struct gges_cfggp_node *replace_subtree(struct gges_cfggp_node *tree,
+                                               struct tree_site *site,
+                                               struct gges_cfggp_node *rep);
 
 static bool sensible_init(struct gges_bnf_grammar *g,
                           struct gges_cfggp_node **t,
@@ -28,29 +64,32 @@ static bool sensible_init(struct gges_bnf_grammar *g,
                           int depth, int min_depth, int max_depth,
                           double (*rnd)(void));
 
-static int pick_subtree(struct gges_cfggp_node **pick,
-                        struct gges_cfggp_node *parent,
-                        struct gges_bnf_non_terminal *required_type,
-                        enum gges_cfggp_node_selection node_sel,
-                        double (*rnd)(void));
+static struct gges_cfggp_node *build_tree(struct gges_bnf_grammar *g,
+                                          struct gges_bnf_production **seq,
+                                          int *pos,
+                                          double (*rnd)(void));
 
-static struct gges_cfggp_node *perform_tree_swap(struct gges_cfggp_node **tree,
-                                                 struct gges_cfggp_node *pick,
-                                                 int pick_idx,
-                                                 struct gges_cfggp_node *rep);
+static bool pick_subtree(struct tree_site *site,
+                         struct gges_cfggp_node *tree,
+                         struct gges_bnf_non_terminal *required_type,
+                         enum gges_cfggp_node_selection node_sel,
+                         double (*rnd)(void));
+
+static void release_site(struct tree_site *site);
 
-static void gges_cfggp_crossover(struct gges_cfggp_node *mother,
+static bool gges_cfggp_crossover(struct gges_cfggp_node *mother,
                                  struct gges_cfggp_node *father,
                                  struct gges_cfggp_node **daughter,
                                  struct gges_cfggp_node **son,
-                                 int max_depth,
+                                 int max_depth, int max_size,
                                  enum gges_cfggp_node_selection node_sel,
                                  double (*rnd)(void));
 
-static void gges_cfggp_mutation(struct gges_bnf_grammar *g,
+static bool gges_cfggp_mutation(struct gges_bnf_grammar *g,
                                 struct gges_cfggp_node **tree,
-                                int mut_depth, int max_depth,
+                                int mut_depth, int max_depth, int max_size,
                                 enum gges_cfggp_node_selection node_sel,
+                                enum gges_cfggp_mutation_method mut_method,
                                 double (*rnd)(void));
 
 
@@ -67,23 +106,30 @@ void gges_cfggp_release_tree(struct gges_cfggp_node *tree)
 
     if (tree == NULL) return;
 
+    /* the tree is still in use elsewhere, so just drop the reference
+     * to it */
+    if (--(tree->refs) > 0) return;
+
     while (tree->num_nt--) gges_cfggp_release_tree(tree->children[tree->num_nt]);
 
     free(tree->children);
 
-    for (i = 0; i < tree->p->size; ++i) free(tree->data_fields[i]);
-    free(tree->data_fields);
+    if (tree->data_fields) {
+        for (i = 0; i < tree->p->size; ++i) {
+            if (tree->p->tokens[i].data_field) gges_bnf_release_data_field(tree->data_fields + i);
+        }
+        free(tree->data_fields);
+    }
 
     free(tree);
 }
 
 
 
-bool gges_cfggp_map_tree(struct gges_cfggp_node *tree, struct gges_mapping *mapping)
+bool gges_cfggp_map_tree(struct gges_cfggp_node *tree, struct gges_mapping *mapping,
+                         int max_length)
 {
-    map_sequence(mapping, tree);
-
-    return true;
+    return map_sequence(mapping, tree, max_length);
 }
 
 
@@ -107,13 +153,7 @@ bool gges_cfggp_random_init(struct gges_bnf_grammar *g,
     gges_cfggp_release_tree(*tree);
     *tree = NULL;
 
-    if (sensible_init(g, tree, start, 1, 1, max_depth, rnd)) {
-        calculate_depths(*tree);
-
-        return true;
-    } else {
-        return false;
-    }
+    return sensible_init(g, tree, start, 1, 1, max_depth, rnd);
 }
 
 
@@ -137,13 +177,63 @@ bool gges_cfggp_sensible_init(struct gges_bnf_grammar *g,
     gges_cfggp_release_tree(*tree);
     *tree = NULL;
 
-    if (sensible_init(g, tree, start, 1, min_depth, max_depth, rnd)) {
-        calculate_depths(*tree);
+    return sensible_init(g, tree, start, 1, min_depth, max_depth, rnd);
+}
+
 
-        return true;
+
+bool gges_cfggp_sized_init(struct gges_bnf_grammar *g,
+                           struct gges_cfggp_node **tree,
+                           int min_size, int max_size, int max_depth,
+                           double (*rnd)(void))
+{
+    struct gges_bnf_non_terminal *start;
+    struct gges_bnf_production **seq;
+    int pos, attempt;
+
+    if (g->start == NULL) {
+        /* the supplied grammar has no explicitly nominated start
+         * symbol, so we will use the first defined non-terminal as
+         * our starting point */
+        start = g->non_terminals + 0;
     } else {
-        return false;
+        start = g->start;
+    }
+
+    gges_cfggp_release_tree(*tree);
+    *tree = NULL;
+
+    /* sample the productions of the tree, and then build it in a
+     * single pass. Trees that are too deep are rejected and drawn
+     * again, which keeps the sampling uniform over the trees that
+     * fit within the depth limit */
+    seq = ALLOC(max_size, sizeof(struct gges_bnf_production *), false);
+    for (attempt = 0; attempt < SIZED_INIT_ATTEMPTS; ++attempt) {
+        if (gges_bnf_sample_derivation(g, start, min_size, max_size, seq, rnd) == 0) {
+            fprintf(stderr, "%s:%d - WARNING: Failed to create a tree, as the grammar "
+                    "cannot produce a tree with between %d and %d nodes.\n",
+                    __FILE__, __LINE__, min_size, max_size);
+            free(seq);
+            return false;
+        }
+
+        pos = 0;
+        *tree = build_tree(g, seq, &pos, rnd);
+        if ((max_depth <= 0) || ((*tree)->depth <= max_depth)) {
+            free(seq);
+            return true;
+        }
+
+        gges_cfggp_release_tree(*tree);
+        *tree = NULL;
     }
+    free(seq);
+
+    fprintf(stderr, "%s:%d - WARNING: Failed to create a tree with between %d and %d "
+            "nodes within a depth of %d after %d attempts.\n",
+            __FILE__, __LINE__, min_size, max_size, max_depth, SIZED_INIT_ATTEMPTS);
+
+    return false;
 }
 
 
@@ -155,12 +245,46 @@ struct gges_derivation_tree *gges_cfggp_derive(struct gges_cfggp_node *tree)
 
 
 
+void gges_cfggp_visit_tokens(struct gges_cfggp_node *tree,
+                             gges_cfggp_token_visitor visit,
+                             void *context)
+{
+    int i, j;
+
+    if (tree == NULL) return;
+
+    j = 0;
+    for (i = 0; i < tree->p->size; ++i) {
+        if (!tree->p->tokens[i].terminal) {
+            gges_cfggp_visit_tokens(tree->children[j++], visit, context);
+        } else if (tree->p->tokens[i].data_field) {
+            visit(tree->p->tokens + i, tree->data_fields + i, context);
+        } else {
+            visit(tree->p->tokens + i, NULL, context);
+        }
+    }
+}
+
+
+
+uint64_t gges_cfggp_tree_hash(struct gges_cfggp_node *tree)
+{
+    return (tree == NULL) ? 0 : tree->hash;
+}
+
+
+
 void gges_cfggp_reproduction(struct gges_cfggp_node *parent,
                              struct gges_cfggp_node **offspring)
 {
-    /* overwrite the offspring's genome with a clone of the parent */
+    struct gges_cfggp_node *clone;
+
+    /* overwrite the offspring's genome with a clone of the parent -
+     * trees are never modified while shared, so the clone is just
+     * another reference to the parent's tree */
+    clone = share_tree(parent);
     gges_cfggp_release_tree(*offspring);
-    *offspring = replicate_tree(parent);
+    *offspring = clone;
 }
 
 
@@ -170,26 +294,30 @@ bool gges_cfggp_breed(struct gges_bnf_grammar *g,
                       struct gges_cfggp_node *father,
                       struct gges_cfggp_node **daughter,
                       struct gges_cfggp_node **son,
-                      int mut_depth, int max_depth,
+                      int mut_depth, int max_depth, int max_size,
                       enum gges_cfggp_node_selection node_sel,
+                      enum gges_cfggp_mutation_method mut_method,
                       double pc, double pm,
                       double (*rnd)(void))
 {
     double p;
+    bool d_changed, s_changed;
 
     p = rnd();
     if (p < pc) {
-        gges_cfggp_crossover(mother, father, daughter, son, max_depth, node_sel, rnd);
-        return false;
+        return !gges_cfggp_crossover(mother, father, daughter, son,
+                                     max_depth, max_size, node_sel, rnd);
     } else {
         gges_cfggp_reproduction(mother, daughter);
         gges_cfggp_reproduction(father, son);
 
         if (p < (pm + pc)) {
-            gges_cfggp_mutation(g, daughter, mut_depth, max_depth, node_sel, rnd);
-            gges_cfggp_mutation(g, son, mut_depth, max_depth, node_sel, rnd);
+            d_changed = gges_cfggp_mutation(g, daughter, mut_depth, max_depth, max_size,
+                                            node_sel, mut_method, rnd);
+            s_changed = gges_cfggp_mutation(g, son, mut_depth, max_depth, max_size,
+                                            node_sel, mut_method, rnd);
 
-            return false;
+            return !(d_changed || s_changed);
         }
 
         return true;
@@ -213,15 +341,15 @@ static struct gges_cfggp_node *create_node(struct gges_bnf_production *p)
 
     node = ALLOC(1, sizeof(struct gges_cfggp_node), false);
 
-    node->parent = NULL;
+    node->refs = 1;
 
     node->p = p;
 
-    node->depth = 0; /* this will be calculated once the tree is
-                      * complete */
+    node->depth = 1; /* this will be updated as the children of the
+                      * node are attached */
 
-    node->size = 1;  /* this will be calculated properly once the tree
-                      * is complete */
+    node->size = 1;  /* this will be updated as the children of the
+                      * node are attached */
 
     node->num_nt = 0;
     for (i = 0; i < p->size; ++i) {
@@ -231,15 +359,49 @@ static struct gges_cfggp_node *create_node(struct gges_bnf_production *p)
     node->children = ALLOC(node->num_nt, sizeof(struct gges_cfggp_node *), false);
     for (i = 0; i < node->num_nt; ++i) node->children[i] = NULL;
 
-    node->data_fields = ALLOC(p->size, sizeof(char *), false);
-    for (i = 0; i < p->size; ++i) node->data_fields[i] = NULL;
+    /* data fields are rare, so only productions that use them carry
+     * the storage for them */
+    node->data_fields = NULL;
+    for (i = 0; i < p->size; ++i) {
+        if (p->tokens[i].data_field) {
+            node->data_fields = ALLOC(p->size, sizeof(struct gges_bnf_data_field), true);
+            break;
+        }
+    }
 
     return node;
 }
 
 
 
-static struct gges_cfggp_node *replicate_tree(struct gges_cfggp_node *t)
+static void copy_data_fields(struct gges_cfggp_node *dest,
+                             struct gges_cfggp_node *t)
+{
+    int i;
+
+    if (t->data_fields == NULL) return;
+
+    for (i = 0; i < t->p->size; ++i) {
+        if (t->p->tokens[i].data_field) {
+            gges_bnf_copy_data_field(dest->data_fields + i, t->data_fields + i);
+        }
+    }
+}
+
+
+
+static struct gges_cfggp_node *share_tree(struct gges_cfggp_node *t)
+{
+    if (t != NULL) t->refs++;
+
+    return t;
+}
+
+
+
+/* creates an unshared copy of a single node, which refers to the same
+ * children as the original node */
+static struct gges_cfggp_node *copy_node(struct gges_cfggp_node *t)
 {
     int i;
     struct gges_cfggp_node *dest;
@@ -248,35 +410,26 @@ static struct gges_cfggp_node *replicate_tree(struct gges_cfggp_node *t)
 
     dest->depth = t->depth;
     dest->size = t->size;
+    dest->hash = t->hash;
 
     for (i = 0; i < dest->num_nt; ++i) {
-        dest->children[i] = replicate_tree(t->children[i]);
-        dest->children[i]->parent = dest;
+        dest->children[i] = share_tree(t->children[i]);
     }
 
-    for (i = 0; i < t->p->size; ++i) {
-        if (t->data_fields[i]) {
-            dest->data_fields[i] = ALLOC((strlen(t->data_fields[i]) + 1), sizeof(char), false);
-            if (dest->data_fields[i] == NULL) {
-                fprintf(stderr, "%s:%d - ERROR: Failed to allocate memory\n",
-                        __FILE__, __LINE__);
-                exit(EXIT_FAILURE);
-            }
-            strcpy(dest->data_fields[i], t->data_fields[i]);
-        }
-    }
+    copy_data_fields(dest, t);
 
     return dest;
 }
 
 
 
-static void map_sequence(struct gges_mapping *m,
-                         struct gges_cfggp_node *t)
+static bool map_sequence(struct gges_mapping *m,
+                         struct gges_cfggp_node *t, int max_length)
 {
     int i, j;
+    char text[GGES_DATA_FIELD_TEXT_LEN];
 
-    if (t == NULL) return;
+    if (t == NULL) return true;
 
     j = 0;
     for (i = 0; i < t->p->size; ++i) {
@@ -284,7 +437,7 @@ static void map_sequence(struct gges_mapping *m,
             /* current token is a terminal, and needs to be printed
              * into the destination stream */
             if (t->p->tokens[i].data_field) {
-                gges_mapping_append_symbol(m, t->data_fields[i]);
+                gges_mapping_append_symbol(m, (char *)gges_bnf_data_field_text(t->data_fields + i, text));
             } else {
                 gges_mapping_append_symbol(m, t->p->tokens[i].symbol);
             }
@@ -293,9 +446,12 @@ static void map_sequence(struct gges_mapping *m,
              * further expansion. We do this via a recursive call to
              * the relevant production of the corresponding
              * non-terminal */
-            map_sequence(m, t->children[j++]);
+            if (!map_sequence(m, t->children[j++], max_length)) return false;
         }
     }
+
+    /* stop as soon as the phenotype becomes too long */
+    return (max_length <= 0) || (m == NULL) || (m->l <= max_length);
 }
 
 
@@ -304,6 +460,8 @@ static struct gges_derivation_tree *map_derivation(
     struct gges_cfggp_node *t)
 {
     int i, c;
+    const char *field;
+    char text[GGES_DATA_FIELD_TEXT_LEN];
     struct gges_derivation_tree *dt, *sub;
 
     dt = gges_create_derivation_tree(t->p->size);
@@ -315,8 +473,9 @@ static struct gges_derivation_tree *map_derivation(
         if (t->p->tokens[i].terminal) {
             sub = gges_create_derivation_tree(0);
             if (t->p->tokens[i].data_field) {
-                sub->label = ALLOC((strlen(t->data_fields[i]) + 1), sizeof(char), false);
-                strcpy(sub->label, t->data_fields[i]);
+                field = gges_bnf_data_field_text(t->data_fields + i, text);
+                sub->label = ALLOC((strlen(field) + 1), sizeof(char), false);
+                strcpy(sub->label, field);
             } else {
                 sub->label = ALLOC(strlen(t->p->tokens[i].symbol) + 1, sizeof(char), false);
                 if (sub->label == NULL) {
@@ -337,20 +496,145 @@ static struct gges_derivation_tree *map_derivation(
 
 
 
-static void calculate_depths(struct gges_cfggp_node *t)
+/* folds the given bytes into a running FNV-1a hash */
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n)
+{
+    const unsigned char *b = data;
+
+    while (n--) {
+        h ^= *b++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+
+/* computes the structural hash of a node from its production, its
+ * data fields and the (already computed) hashes of its children */
+static uint64_t hash_node(struct gges_cfggp_node *t)
 {
     int i;
+    uint64_t h;
+    struct gges_bnf_data_field *f;
+
+    h = 0xcbf29ce484222325ULL;
+    h = hash_bytes(h, &(t->p), sizeof(t->p));
+
+    for (i = 0; t->data_fields && i < t->p->size; ++i) {
+        if (!t->p->tokens[i].data_field) continue;
+
+        f = t->data_fields + i;
+        switch (f->type) {
+        case GGES_DATA_FIELD_DOUBLE:
+            h = hash_bytes(h, &(f->value.d), sizeof(double));
+            break;
+        case GGES_DATA_FIELD_INT:
+            h = hash_bytes(h, &(f->value.i), sizeof(int));
+            break;
+        default:
+            /* the terminating character is included to keep adjacent
+             * fields distinct */
+            if (f->value.s) h = hash_bytes(h, f->value.s, strlen(f->value.s) + 1);
+            break;
+        }
+    }
 
-    t->depth = 1;
-    t->size = 1;
     for (i = 0; i < t->num_nt; ++i) {
-        calculate_depths(t->children[i]);
-        if ((t->children[i]->depth + 1) > t->depth) {
-            t->depth = t->children[i]->depth + 1;
+        h = hash_bytes(h, &(t->children[i]->hash), sizeof(uint64_t));
+    }
+
+    return h;
+}
+
+
+
+/* recalculates the depth, size and hash of a node from its children,
+ * returning true if any of them changed */
+static bool refresh_node(struct gges_cfggp_node *t)
+{
+    int i, depth, size;
+    uint64_t hash;
+    bool changed;
+
+    depth = 1;
+    size = 1;
+    for (i = 0; i < t->num_nt; ++i) {
+        if ((t->children[i]->depth + 1) > depth) {
+            depth = t->children[i]->depth + 1;
         }
+        size += t->children[i]->size;
+    }
+
+    hash = hash_node(t);
+
+    changed = (depth != t->depth) || (size != t->size) || (hash != t->hash);
+    t->depth = depth;
+    t->size = size;
+    t->hash = hash;
+
+    return changed;
+}
 
-        t->size += t->children[i]->size;
+
+
+/* replaces the subtree at the given site with rep, taking over the
+ * caller's reference to both tree and rep, and returns the root of
+ * the resulting tree.
+ *
+ * Shared nodes are never modified, so any node on the path that is
+ * shared (or lies below a shared node) is copied, with the copy
+ * referring to the same untouched children as the original. The
+ * remaining nodes at the top of the path belong only to this tree,
+ * and are updated in place, stopping as soon as the depth, size and
+ * hash of a node no longer change */
+static struct gges_cfggp_node *replace_subtree(struct gges_cfggp_node *tree,
+                                               struct tree_site *site,
+                                               struct gges_cfggp_node *rep)
+{
+    int k, shared;
+    struct gges_cfggp_node *t, *old;
+    bool in_place;
+
+    /* find the first node on the path that is shared */
+    for (shared = 0; shared < site->level; ++shared) {
+        if (site->nodes[shared]->refs > 1) break;
     }
+
+    in_place = false;
+    for (k = site->level - 1; k--;) {
+        if (k < shared) {
+            /* the node belongs only to this tree, so hook the new
+             * subtree straight in, and release the one it replaced
+             * (unless that was itself updated in place, in which case
+             * it is still the child) */
+            t = site->nodes[k];
+            old = t->children[site->branch[k]];
+            t->children[site->branch[k]] = rep;
+            if (!in_place) gges_cfggp_release_tree(old);
+            in_place = true;
+
+            /* if this node is unchanged, then so are its ancestors */
+            if (!refresh_node(t)) return tree;
+        } else {
+            /* the node is visible from other trees, so the change has
+             * to be made to a copy of the node */
+            t = copy_node(site->nodes[k]);
+            gges_cfggp_release_tree(t->children[site->branch[k]]);
+            t->children[site->branch[k]] = rep;
+
+            refresh_node(t);
+        }
+
+        rep = t;
+    }
+
+    /* unless the root was updated in place, the caller's reference to
+     * the original tree is no longer needed */
+    if ((site->level == 1) || (shared == 0)) gges_cfggp_release_tree(tree);
+
+    return rep;
 }
 
 
@@ -421,7 +705,7 @@ static bool sensible_init(struct gges_bnf_grammar *g,
         for (i = 0; i < p->size; ++i) {
             if (p->tokens[i].terminal) {
                 if (p->tokens[i].data_field) {
-                    (*t)->data_fields[i] = gges_bnf_init_data_field(g, p->tokens[i].symbol, rnd);
+                    gges_bnf_init_data_field(g, p->tokens[i].symbol, (*t)->data_fields + i, rnd);
                 }
                 continue;
             }
@@ -431,8 +715,17 @@ static bool sensible_init(struct gges_bnf_grammar *g,
                                     rnd);
             if (!success) break;
 
-            (*t)->children[c++]->parent = *t;
+            /* the subtree is complete, so fold its depth and size into
+             * the current node */
+            if (((*t)->children[c]->depth + 1) > (*t)->depth) {
+                (*t)->depth = (*t)->children[c]->depth + 1;
+            }
+            (*t)->size += (*t)->children[c]->size;
+            c++;
         }
+
+        /* with all the children in place, the hash can be computed */
+        if (success) (*t)->hash = hash_node(*t);
     }
 
     /* cleanup */
@@ -442,6 +735,37 @@ static bool sensible_init(struct gges_bnf_grammar *g,
 }
 
 
+/* builds the tree described by the given sequence of productions
+ * (listed in the order that they are applied in a leftmost
+ * derivation) */
+static struct gges_cfggp_node *build_tree(struct gges_bnf_grammar *g,
+                                          struct gges_bnf_production **seq,
+                                          int *pos,
+                                          double (*rnd)(void))
+{
+    int i, c;
+    struct gges_cfggp_node *t;
+    struct gges_bnf_production *p;
+
+    p = seq[(*pos)++];
+    t = create_node(p);
+
+    c = 0;
+    for (i = 0; i < p->size; ++i) {
+        if (!p->tokens[i].terminal) {
+            t->children[c++] = build_tree(g, seq, pos, rnd);
+        } else if (p->tokens[i].data_field) {
+            gges_bnf_init_data_field(g, p->tokens[i].symbol, t->data_fields + i, rnd);
+        }
+    }
+
+    refresh_node(t);
+
+    return t;
+}
+
+
+
 /* recursively scans a tree and sums the depths of all the subtrees
  * that match the required "type" (i.e., non-terminal of the
  * grammar). If no specific type is required, then the required type
@@ -472,16 +796,21 @@ static double sum_tree_vals(struct gges_cfggp_node *t,
 
 /* recursively scans the tree to find the subtree that matches the
  * required non-terminal label, and was selected in the roulette wheel
- * process (proportional to subtree depth) */
+ * process (proportional to subtree depth). The path taken to reach
+ * each node is recorded in the supplied site as the search
+ * proceeds */
 static struct gges_cfggp_node *locate_subtree(
     struct gges_cfggp_node *t,
     struct gges_bnf_non_terminal *required_type,
     enum gges_cfggp_node_selection node_sel,
-    double *remaining_sum)
+    double *remaining_sum,
+    struct tree_site *site, int level)
 {
     struct gges_cfggp_node *s;
     int i;
 
+    site->nodes[level - 1] = t;
+
     if ((required_type == NULL) || (t->p->nt == required_type)) {
         switch (node_sel) {
         case PICK_NODE_UNIFORM_RANDOM: default: *remaining_sum -= 1; break;
@@ -491,14 +820,19 @@ static struct gges_cfggp_node *locate_subtree(
 
         /* if the remaining depth is wiped out, then we have
          * identified the node that we want to select */
-        if (*remaining_sum <= 0) return t;
+        if (*remaining_sum <= 0) {
+            site->level = level;
+            return t;
+        }
     }
 
     /* if we reach here, then the required node was not identified,
      * and therefore we need to descend into the current tree's
      * children */
     for (i = 0; i < t->num_nt; ++i) {
-        s = locate_subtree(t->children[i], required_type, node_sel, remaining_sum);
+        site->branch[level - 1] = i;
+        s = locate_subtree(t->children[i], required_type, node_sel, remaining_sum,
+                           site, level + 1);
 
         /* if the recursive search of the subtree identified the
          * subtree, then we do not need to proceed with the search any
@@ -515,121 +849,86 @@ static struct gges_cfggp_node *locate_subtree(
 
 /* selects a subtree in the given tree in a roulette wheel like
  * process where the probability of selection of a subtree is
- * proportional to its depth */
-static int pick_subtree(struct gges_cfggp_node **pick,
-                        struct gges_cfggp_node *parent,
-                        struct gges_bnf_non_terminal *required_type,
-                        enum gges_cfggp_node_selection node_sel,
-                        double (*rnd)(void))
+ * proportional to its depth. The location of the chosen subtree is
+ * returned through the supplied site, which should be released by the
+ * caller. Returns false if no suitable subtree could be found */
+static bool pick_subtree(struct tree_site *site,
+                         struct gges_cfggp_node *tree,
+                         struct gges_bnf_non_terminal *required_type,
+                         enum gges_cfggp_node_selection node_sel,
+                         double (*rnd)(void))
 {
-    int i;
     double node_sum;
 
-    node_sum = sum_tree_vals(parent, required_type, node_sel);
+    /* the path to any node can be no longer than the depth of the
+     * tree, so size the site to suit */
+    site->level = 0;
+    site->nodes = REALLOC(site->nodes, tree->depth, sizeof(struct gges_cfggp_node *));
+    site->branch = REALLOC(site->branch, tree->depth, sizeof(int));
+
+    node_sum = sum_tree_vals(tree, required_type, node_sel);
     if (node_sum == 0) {
         /* no subtrees of the required type exist in the tree */
-        *pick = NULL;
-
-        return -1;
+        return false;
     }
 
     /* pick a random point in the tree proportional to depth, and then
      * perform the search for the node */
     node_sum = (rnd() * node_sum);
-    *pick = locate_subtree(parent, required_type, node_sel, &node_sum);
-
-    if (*pick == NULL) {
+    if (locate_subtree(tree, required_type, node_sel, &node_sum, site, 1) == NULL) {
         /* could not find a suitable subtree in the parent */
         fprintf(stderr, "%s%d - WARNING! Could not pick subtree\n",
                 __FILE__, __LINE__);
-        return -1;
-    } else if ((*pick)->parent == NULL) {
-        /* we picked the root of the tree */
-        return -1;
-    } else {
-        /* find the index of the chosen subtree within its parent */
-        for (i = 0; i < (*pick)->parent->num_nt; ++i) {
-            if (*pick == (*pick)->parent->children[i]) return i;
-        }
-
-        /* should not get here unless something has gone wrong */
-        fprintf(stderr, "%s%d - WARNING! Could not pick subtree\n",
-                __FILE__, __LINE__);
-        return -1;
+        return false;
     }
+
+    return true;
 }
 
 
 
-static struct gges_cfggp_node *perform_tree_swap(struct gges_cfggp_node **tree,
-                                                 struct gges_cfggp_node *pick,
-                                                 int pick_idx,
-                                                 struct gges_cfggp_node *rep)
+static void release_site(struct tree_site *site)
 {
-    struct gges_cfggp_node *parent;
-    if (pick == *tree) {
-        /* we're crossing at the root, so replace the root and return it */
-        *tree = rep;
-        return pick;
-    } else {
-        parent = pick->parent;
-
-        parent->children[pick_idx] = rep;
-        pick->parent = rep->parent;
-        rep->parent = parent;
-
-        return pick;
-    }
+    free(site->nodes);
+    free(site->branch);
 }
 
 
 
-static void gges_cfggp_crossover(struct gges_cfggp_node *mother,
+static bool gges_cfggp_crossover(struct gges_cfggp_node *mother,
                                  struct gges_cfggp_node *father,
                                  struct gges_cfggp_node **daughter,
                                  struct gges_cfggp_node **son,
-                                 int max_depth,
+                                 int max_depth, int max_size,
                                  enum gges_cfggp_node_selection node_sel,
                                  double (*rnd)(void))
 {
-    struct gges_cfggp_node *d_cp, *s_cp, *tmp;
-    int d_pidx, s_pidx;
-    int d_allowed_depth, s_allowed_depth;
+    struct tree_site m_site = { 0, NULL, NULL }, f_site = { 0, NULL, NULL };
+    struct gges_cfggp_node *m_cp, *f_cp;
     bool d_ok, s_ok;
 
-    /* first, make clones of the parents */
-    gges_cfggp_reproduction(mother, daughter);
-    gges_cfggp_reproduction(father, son);
-
-    /* then, pick crossover points in the offspring. We need to loop
+    /* first, pick crossover points in the parents. We need to loop
      * this process, as we may select a non-terminal in the first
-     * offspring that does not exist in the second. As both offspring
-     * will have at least one non-terminal in common (the start
-     * symbol), this loop is guaranteed to terminate at some stage,
-     * and will probably never exceed a single iteration in any
-     * problem of reasonable complexity */
+     * parent that does not exist in the second. As both parents will
+     * have at least one non-terminal in common (the start symbol),
+     * this loop is guaranteed to terminate at some stage, and will
+     * probably never exceed a single iteration in any problem of
+     * reasonable complexity */
     do {
-        d_pidx = pick_subtree(&d_cp, *daughter, NULL, node_sel, rnd);
-        s_pidx = pick_subtree(&s_cp, *son, d_cp->p->nt, node_sel, rnd);
-    } while (s_cp == NULL);
+        pick_subtree(&m_site, mother, NULL, node_sel, rnd);
+        m_cp = m_site.nodes[m_site.level - 1];
+    } while (!pick_subtree(&f_site, father, m_cp->p->nt, node_sel, rnd));
+    f_cp = f_site.nodes[f_site.level - 1];
 
     /* and then work out how big the spliced-in trees can be in each
      * of the offspring, to ensure that we are not exceeding crossover
      * depths as defined by the system */
     if (max_depth > 0) {
-        /* depth limiting is being used, so work out available depth
-         * in each offspring tree */
-        d_allowed_depth = max_depth;
-        tmp = d_cp;
-        while ((tmp = tmp->parent) != NULL) d_allowed_depth--;
-
-        s_allowed_depth = max_depth;
-        tmp = s_cp;
-        while ((tmp = tmp->parent) != NULL) s_allowed_depth--;
-
-        /* then, test the validity of each chosen crossover point */
-        d_ok = s_cp->depth <= d_allowed_depth;
-        s_ok = d_cp->depth <= s_allowed_depth;
+        /* depth limiting is being used, so test the validity of each
+         * chosen crossover point against the depth available below
+         * it in each parent tree */
+        d_ok = f_cp->depth <= (max_depth - m_site.level + 1);
+        s_ok = m_cp->depth <= (max_depth - f_site.level + 1);
     } else {
         /* if no depth limiting is used, then the offspring can be
          * crossed without examination */
@@ -637,69 +936,156 @@ static void gges_cfggp_crossover(struct gges_cfggp_node *mother,
         s_ok = true;
     }
 
-    /* finally, perform the crossover */
-    if (d_ok && s_ok) {
-        /* perform a straight swap of subtrees, no additional memory copying required */
-        if (d_cp == *daughter) {
-            *daughter = s_cp;
-        } else {
-            d_cp->parent->children[d_pidx] = s_cp;
+    /* the sizes of the offspring are known without building them, so
+     * offspring that would be too large are rejected up front */
+    if (max_size > 0) {
+        d_ok = d_ok && (mother->size - m_cp->size + f_cp->size) <= max_size;
+        s_ok = s_ok && (father->size - f_cp->size + m_cp->size) <= max_size;
+    }
+
+    /* finally, build the offspring. Each offspring starts out sharing
+     * its parent's tree, and (if the depth and size limits allow it)
+     * then has the subtree donated by the other parent swapped in -
+     * only the nodes on the path from the root to the crossover point
+     * are copied, everything else remains shared with the parents */
+    gges_cfggp_reproduction(mother, daughter);
+    if (d_ok) *daughter = replace_subtree(*daughter, &m_site, share_tree(f_cp));
+
+    gges_cfggp_reproduction(father, son);
+    if (s_ok) *son = replace_subtree(*son, &f_site, share_tree(m_cp));
+
+    release_site(&m_site);
+    release_site(&f_site);
+
+    return d_ok || s_ok;
+}
+
+
+
+/* finds the productions that can replace the given production
+ * without disturbing the subtrees below it, i.e., the other
+ * productions of the same non-terminal that contain exactly the same
+ * sequence of non-terminals */
+static int compatible_productions(struct gges_bnf_production **res,
+                                  struct gges_bnf_production *p)
+{
+    int i, j, k, n;
+    struct gges_bnf_production *q;
+
+    n = 0;
+    for (i = 0; i < p->nt->size; ++i) {
+        q = p->nt->productions + i;
+        if (q == p) continue;
+
+        /* walk the non-terminals of both productions in step */
+        j = k = 0;
+        while (true) {
+            while (j < p->size && p->tokens[j].terminal) j++;
+            while (k < q->size && q->tokens[k].terminal) k++;
+
+            if (j == p->size || k == q->size) break;
+            if (p->tokens[j].nt != q->tokens[k].nt) break;
+
+            j++;
+            k++;
         }
-        if (s_cp == *son) {
-            *son = d_cp;
-        } else {
-            s_cp->parent->children[s_pidx] = d_cp;
+
+        if (j == p->size && k == q->size) res[n++] = q;
+    }
+
+    return n;
+}
+
+
+
+/* switches the production used by a node, instantiating any data
+ * fields that the new production requires */
+static void set_production(struct gges_bnf_grammar *g,
+                           struct gges_cfggp_node *t,
+                           struct gges_bnf_production *p,
+                           double (*rnd)(void))
+{
+    int i;
+
+    if (t->data_fields) {
+        for (i = 0; i < t->p->size; ++i) {
+            if (t->p->tokens[i].data_field) gges_bnf_release_data_field(t->data_fields + i);
         }
+        free(t->data_fields);
+        t->data_fields = NULL;
+    }
 
-        tmp = d_cp->parent;
-        d_cp->parent = s_cp->parent;
-        s_cp->parent = tmp;
+    t->p = p;
 
-        /* recalculate depths in the offspring */
-        calculate_depths(*daughter);
-        calculate_depths(*son);
-    } else if (d_ok) {
-        /* in this case, the crossover operation will result in the
-         * son offspring being too large, but a daughter that is of
-         * suitable size. In this case, we need to make a copy of the
-         * subtree that we selected from the son, splice that into the
-         * daughter, and leave the other offspring unchanged */
-        s_cp = replicate_tree(s_cp);
+    for (i = 0; i < p->size; ++i) {
+        if (!p->tokens[i].data_field) continue;
+
+        if (t->data_fields == NULL) {
+            t->data_fields = ALLOC(p->size, sizeof(struct gges_bnf_data_field), true);
+        }
+        gges_bnf_init_data_field(g, p->tokens[i].symbol, t->data_fields + i, rnd);
+    }
+}
 
-        tmp = perform_tree_swap(daughter, d_cp, d_pidx, s_cp);
-        gges_cfggp_release_tree(tmp);
 
-        calculate_depths(*daughter);
-    } else if (s_ok) {
-        /* in this case, the crossover operation will result in the
-         * daughter offspring being too large, but a son that is of
-         * suitable size. In this case, we need to make a copy of the
-         * subtree that we selected from the daughter, splice that
-         * into the son, and leave the other offspring unchanged */
-        d_cp = replicate_tree(d_cp);
 
-        tmp = perform_tree_swap(son, s_cp, s_pidx, d_cp);
-        gges_cfggp_release_tree(tmp);
+/* replaces the production of the node at the given site with another
+ * production that keeps its children intact. If no such production
+ * exists, then the tree is left untouched and false is returned */
+static bool point_mutation(struct gges_bnf_grammar *g,
+                           struct gges_cfggp_node **tree,
+                           struct tree_site *site,
+                           double (*rnd)(void))
+{
+    int i, n;
+    struct gges_bnf_production **choices, *p;
+    struct gges_cfggp_node *mp, *rep;
+
+    mp = site->nodes[site->level - 1];
+
+    choices = ALLOC(mp->p->nt->size, sizeof(struct gges_bnf_production *), false);
+    n = compatible_productions(choices, mp->p);
+    p = (n > 0) ? choices[(int)(rnd() * n)] : NULL;
+    free(choices);
 
-        calculate_depths(*son);
+    if (p == NULL) return false;
+
+    /* if no part of the path to the node is shared, then the node can
+     * be changed where it is, otherwise a new node is made that
+     * refers to the same children. Either way, the depth and size of
+     * the tree do not change */
+    for (i = 0; i < site->level; ++i) {
+        if (site->nodes[i]->refs > 1) break;
+    }
+
+    if (i == site->level) {
+        rep = share_tree(mp);
+    } else {
+        rep = create_node(mp->p);
+        for (i = 0; i < rep->num_nt; ++i) rep->children[i] = share_tree(mp->children[i]);
     }
+    set_production(g, rep, p, rnd);
+    refresh_node(rep);
+
+    *tree = replace_subtree(*tree, site, rep);
+
+    return true;
 }
 
 
 
-static void gges_cfggp_mutation(struct gges_bnf_grammar *g,
-                                struct gges_cfggp_node **tree,
-                                int mut_depth, int max_depth,
-                                enum gges_cfggp_node_selection node_sel,
-                                double (*rnd)(void))
+/* replaces the subtree at the given site with a newly grown subtree */
+static bool subtree_mutation(struct gges_bnf_grammar *g,
+                             struct gges_cfggp_node **tree,
+                             struct tree_site *site,
+                             int mut_depth, int max_depth, int max_size,
+                             double (*rnd)(void))
 {
-    struct gges_cfggp_node *mp, *mut, *tmp;
+    struct gges_cfggp_node *mp, *mut;
 
-    int pidx;
     int allowed_depth;
 
-    /* pick a site in the tree */
-    pidx = pick_subtree(&mp, *tree, NULL, node_sel, rnd);
+    mp = site->nodes[site->level - 1];
 
     /* we need to ensure that the mutation of the tree does not
      * exceed the depth limits of the system. We can do this by
@@ -707,23 +1093,58 @@ static void gges_cfggp_mutation(struct gges_bnf_grammar *g,
      * greater than the remaining availble tree depth at the point of
      * mutation */
     if (max_depth > 0) {
-        allowed_depth = max_depth;
-        tmp = mp;
-        while ((tmp = tmp->parent) != NULL) allowed_depth--;
+        allowed_depth = max_depth - site->level + 1;
 
         if (mut_depth > allowed_depth) mut_depth = allowed_depth;
     }
 
     /* grow a mutant subtree using the non-terminal LHS of the
-     * production of the identified site */
-    sensible_init(g, &mut, mp->p->nt, 1, 1, mut_depth, rnd);
+     * production of the identified site. If it cannot be grown within
+     * the remaining depth, then the (partial) mutant is dropped, and
+     * the tree is left as it was */
+    if (!sensible_init(g, &mut, mp->p->nt, 1, 1, mut_depth, rnd)) {
+        gges_cfggp_release_tree(mut);
+        return false;
+    }
 
-    /* swap the subtree with the mutant */
-    tmp = perform_tree_swap(tree, mp, pidx, mut);
+    /* if the mutant would make the tree too large, then leave the
+     * tree as it was */
+    if (max_size > 0 && ((*tree)->size - mp->size + mut->size) > max_size) {
+        gges_cfggp_release_tree(mut);
+        return false;
+    }
+
+    /* swap the subtree with the mutant, copying the path down to the
+     * site if the tree is shared with any other individual */
+    *tree = replace_subtree(*tree, site, mut);
+
+    return true;
+}
+
+
+
+static bool gges_cfggp_mutation(struct gges_bnf_grammar *g,
+                                struct gges_cfggp_node **tree,
+                                int mut_depth, int max_depth, int max_size,
+                                enum gges_cfggp_node_selection node_sel,
+                                enum gges_cfggp_mutation_method mut_method,
+                                double (*rnd)(void))
+{
+    struct tree_site site = { 0, NULL, NULL };
+    bool changed;
+
+    /* pick a site in the tree */
+    pick_subtree(&site, *tree, NULL, node_sel, rnd);
+
+    /* point mutation is not always possible (e.g., a non-terminal
+     * with a single production), in which case the subtree at the
+     * site is regrown instead */
+    changed = (mut_method == POINT_MUTATION) && point_mutation(g, tree, &site, rnd);
+    if (!changed) {
+        changed = subtree_mutation(g, tree, &site, mut_depth, max_depth, max_size, rnd);
+    }
 
-    /* cleanup the old subtree that was removed from the tree */
-    gges_cfggp_release_tree(tmp);
+    release_site(&site);
 
-    /* recalculate depths in the genome */
-    calculate_depths(*tree);
+    return changed;
 }
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <limits.h>
 
 #include "grammar.h"
@@ -17,7 +18,15 @@ extern "C" {
      * structure that represents a derivation tree in which the
      * terminal nodes have been removed. This derivation tree can then
      * be quickly executed to produce the required instance of the
-     * grammar */
+     * grammar
+     *
+     * subtrees are shared between individuals wherever possible
+     * (e.g., a cloned individual refers to the same tree as its
+     * parent), so a node that is referred to more than once must be
+     * treated as immutable - the genetic operators take care of this
+     * by copying the path from the root down to any node that they
+     * change. A consequence of this is that nodes cannot know their
+     * parent */
     struct gges_cfggp_node {
         /* the production used at this point in the derivation tree */
         struct gges_bnf_production *p;
@@ -34,23 +43,45 @@ extern "C" {
          * non-terminal components of this production */
         struct gges_cfggp_node **children;
 
-        /* the parent of the current node (NULL if the root) */
-        struct gges_cfggp_node *parent;
+        /* the number of references (from individuals, or from
+         * parent nodes) held to this node */
+        int refs;
+
+        /* a structural hash of the subtree rooted at this node,
+         * combining the production, the data fields and the hashes of
+         * the children. Two structurally identical subtrees (built
+         * from the same grammar) will have the same hash */
+        uint64_t hash;
 
         /* this allows custom data (e.g., the value instantiated as
          * part of an ephemeral random constant) to be embedded into
          * the node so that it can be expressed into the sentence that
-         * gets produced from this tree */
-        char **data_fields;
+         * gets produced from this tree. The array is indexed by
+         * token position, and is NULL if the production has no data
+         * field tokens */
+        struct gges_bnf_data_field *data_fields;
     };
 
-    /* constructor and destructor for CFG-GP trees */
+    /* callback used to walk the terminal tokens of a tree in
+     * phenotype order. For data field tokens, the instantiated value
+     * is supplied (in its native type) through field, otherwise field
+     * is NULL */
+    typedef void (*gges_cfggp_token_visitor)(struct gges_bnf_token *token,
+                                             struct gges_bnf_data_field *field,
+                                             void *context);
+
+    /* destructor for CFG-GP trees - this releases a single reference
+     * to the tree, which is only freed once it is no longer used by
+     * anything else */
     void gges_cfggp_release_tree(struct gges_cfggp_node *tree);
 
     /* runs the process that maps the given tree into the
      * corresponding executable code via the grammar used to
-     * initialise the tree */
-    bool gges_cfggp_map_tree(struct gges_cfggp_node *tree, struct gges_mapping *mapping);
+     * initialise the tree. If max_length is greater than zero, then
+     * the mapping fails if the phenotype is longer than max_length
+     * characters */
+    bool gges_cfggp_map_tree(struct gges_cfggp_node *tree, struct gges_mapping *mapping,
+                             int max_length);
 
     /* initialises the derivation tree using Whigham's method
      * (1995). The last parameter is a pseudorandom number generator
@@ -72,19 +103,56 @@ extern "C" {
                                   int min_depth, int max_depth,
                                   double (*rnd)(void));
 
+    /* initialises the derivation tree by sampling uniformly from all
+     * the trees that the grammar can produce with a size (i.e., node
+     * count) in [min_size, max_size] and a depth of at most max_depth
+     * (if max_depth is greater than zero). The last parameter is a
+     * pseudorandom number generator function pointer that returns
+     * values in [0,1) */
+    bool gges_cfggp_sized_init(struct gges_bnf_grammar *g,
+                               struct gges_cfggp_node **tree,
+                               int min_size, int max_size, int max_depth,
+                               double (*rnd)(void));
+
     struct gges_derivation_tree *gges_cfggp_derive(struct gges_cfggp_node *tree);
 
+    /* visits each terminal token of the tree in the order that they
+     * would appear in the phenotype, allowing evaluators to work
+     * directly from the tokens (and the typed data field values)
+     * rather than parsing the phenotype string */
+    void gges_cfggp_visit_tokens(struct gges_cfggp_node *tree,
+                                 gges_cfggp_token_visitor visit,
+                                 void *context);
+
+    /* returns the structural hash of the tree, which is maintained as
+     * the tree is built and modified, so no traversal is needed. This
+     * allows duplicate trees to be spotted (e.g., to key a cache of
+     * evaluations) without first mapping them to their phenotype */
+    uint64_t gges_cfggp_tree_hash(struct gges_cfggp_node *tree);
+
+    /* replaces the offspring's tree with the parent's tree. As trees
+     * are shared, rather than copied, this is a constant-time
+     * operation */
     void gges_cfggp_reproduction(struct gges_cfggp_node *parent,
                                  struct gges_cfggp_node **offspring);
 
-
+    /* produces two offspring from the given parents via crossover
+     * and/or mutation (either regrowing a subtree, or swapping the
+     * production of a single node for one that keeps the node's
+     * existing subtrees). Any offspring that would be deeper than
+     * max_depth, or have more than max_size nodes, is instead a copy
+     * of its parent (either limit is ignored if <= 0)
+     *
+     * returns true if both offspring are unchanged copies of their
+     * parents */
     bool gges_cfggp_breed(struct gges_bnf_grammar *g,
                           struct gges_cfggp_node *mother,
                           struct gges_cfggp_node *father,
                           struct gges_cfggp_node **daughter,
                           struct gges_cfggp_node **son,
-                          int mut_depth, int max_depth,
+                          int mut_depth, int max_depth, int max_size,
                           enum gges_cfggp_node_selection node_sel,
+                          enum gges_cfggp_mutation_method mut_method,
                           double pc, double pm,
                           double (*rnd)(void));
 
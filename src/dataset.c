@@ -0,0 +1,636 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dataset.h"
+
+#include "alloc.h"
+
+/*******************************************************************************
+ * Private function prototypes
+ ******************************************************************************/
+static char *read_file(const char *file_name);
+
+static bool next_value(char **p, double *value, int *line, bool *end_of_line,
+                       const char *file_name);
+static double *parse_values(char *text, const char *file_name,
+                            int *n_rows, int *n_cols);
+static void parse_folds(struct gges_dataset *d, char *text, const char *file_name);
+
+static struct gges_dataset *create_dataset(int n_rows, int n_features, int block);
+static void allocate_columns(struct gges_dataset *d, int block);
+static void compute_statistics(struct gges_dataset *d);
+
+static bool in_image(struct gges_dataset *d, void *p);
+static uint64_t align_offset(uint64_t offset, uint64_t align);
+static bool write_at(FILE *f, uint64_t *pos, uint64_t offset,
+                     const void *data, size_t n);
+
+
+
+
+
+
+
+
+/*******************************************************************************
+ * Public function implementations
+ ******************************************************************************/
+struct gges_dataset *gges_load_dataset(const char *data_file,
+                                       const char *fold_file,
+                                       int block)
+{
+    int i, j, n_rows, n_cols;
+    char *text;
+    double *values;
+    struct gges_dataset *d;
+
+    d = gges_map_dataset(data_file);
+    if (d != NULL) {
+        /* a fold file replaces any folds stored in the binary file */
+        if (fold_file) {
+            d->n_folds = 0;
+            d->folds = NULL;
+
+            text = read_file(fold_file);
+            parse_folds(d, text, fold_file);
+            free(text);
+        }
+
+        return d;
+    }
+
+    text = read_file(data_file);
+    values = parse_values(text, data_file, &n_rows, &n_cols);
+    free(text);
+
+    if (n_cols < 2) {
+        fprintf(stderr, "%s:%d - ERROR: the data file %s needs at least one feature and a response. Quitting...\n",
+                __FILE__, __LINE__, data_file);
+        exit(EXIT_FAILURE);
+    }
+
+    d = create_dataset(n_rows, n_cols - 1, block);
+    for (i = 0; i < n_rows; ++i) {
+        for (j = 0; j < n_cols; ++j) d->columns[j][i] = values[i * n_cols + j];
+    }
+    free(values);
+
+    if (fold_file) {
+        text = read_file(fold_file);
+        parse_folds(d, text, fold_file);
+        free(text);
+    }
+
+    compute_statistics(d);
+
+    return d;
+}
+
+void gges_release_dataset(struct gges_dataset *d)
+{
+    if (d == NULL) return;
+
+    if ((d->columns != NULL) && !in_image(d, d->columns[0])) free(d->columns[0]);
+    free(d->columns);
+    free(d->single_columns);
+
+    if (!in_image(d, d->folds)) free(d->folds);
+    if (!in_image(d, d->means)) free(d->means);
+    if (!in_image(d, d->sd)) free(d->sd);
+
+    if (d->image) munmap(d->image, d->image_size);
+
+    free(d);
+}
+
+
+
+/* the binary dataset format: a header, followed by the columns (each
+ * holding stride values, as either floats or doubles), the fold
+ * bitmaps, and the column means and standard deviations. Sections are
+ * held at offsets from the start of the file, with the columns aligned
+ * to a cache line. The byte order and value size catch files written
+ * on an incompatible platform */
+#define GGES_DATASET_MAGIC "GGESDAT1"
+#define GGES_DATASET_BYTE_ORDER 0x01020304
+#define GGES_DATASET_ALIGN 64
+
+struct gges_dataset_header {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t value_size;
+    uint64_t size;
+
+    uint64_t columns;
+    uint64_t folds;
+    uint64_t means;
+    uint64_t sd;
+
+    double mean_rmse;
+
+    int32_t n_rows;
+    int32_t n_features;
+    int32_t stride;
+    int32_t n_folds;
+    int32_t fold_words;
+    int32_t unused;
+};
+
+bool gges_write_dataset(struct gges_dataset *d, const char *file_name,
+                        bool single_precision)
+{
+    int i, j, n_columns;
+    char *tmp_name;
+    bool ok;
+    FILE *f;
+    double *values;
+    float *buffer;
+    uint64_t pos;
+    struct gges_dataset_header h;
+
+    n_columns = d->n_features + 1;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, GGES_DATASET_MAGIC, sizeof(h.magic));
+    h.byte_order = GGES_DATASET_BYTE_ORDER;
+    h.value_size = single_precision ? sizeof(float) : sizeof(double);
+    h.mean_rmse = d->mean_rmse;
+    h.n_rows = d->n_rows;
+    h.n_features = d->n_features;
+    h.stride = d->stride;
+    h.n_folds = d->n_folds;
+    h.fold_words = d->fold_words;
+
+    h.columns = align_offset(sizeof(h), GGES_DATASET_ALIGN);
+    h.folds = align_offset(h.columns + (uint64_t)n_columns * d->stride * h.value_size,
+                           GGES_DATASET_ALIGN);
+    h.means = align_offset(h.folds + (uint64_t)d->n_folds * d->fold_words * sizeof(uint64_t),
+                           GGES_DATASET_ALIGN);
+    h.sd = h.means + n_columns * sizeof(double);
+    h.size = h.sd + n_columns * sizeof(double);
+
+    /* write to a private file, then move it into place, so that
+     * concurrent runs never see a partially written dataset */
+    tmp_name = ALLOC(strlen(file_name) + 32, sizeof(char), false);
+    sprintf(tmp_name, "%s.%ld", file_name, (long)getpid());
+
+    ok = false;
+    f = fopen(tmp_name, "wb");
+    if (f != NULL) {
+        pos = 0;
+        ok = write_at(f, &pos, 0, &h, sizeof(h));
+
+        values = ALLOC(d->stride, sizeof(double), false);
+        buffer = single_precision ? ALLOC(d->stride, sizeof(float), false) : NULL;
+        for (j = 0; ok && (j < n_columns); ++j) {
+            gges_dataset_read(d, j, 0, d->stride, values);
+            if (single_precision) {
+                for (i = 0; i < d->stride; ++i) buffer[i] = (float)values[i];
+                ok = write_at(f, &pos, h.columns + (uint64_t)j * d->stride * sizeof(float),
+                              buffer, d->stride * sizeof(float));
+            } else {
+                ok = write_at(f, &pos, h.columns + (uint64_t)j * d->stride * sizeof(double),
+                              values, d->stride * sizeof(double));
+            }
+        }
+        free(buffer);
+        free(values);
+
+        ok = ok && write_at(f, &pos, h.folds, d->folds,
+                            (size_t)d->n_folds * d->fold_words * sizeof(uint64_t));
+        ok = ok && write_at(f, &pos, h.means, d->means, n_columns * sizeof(double));
+        ok = ok && write_at(f, &pos, h.sd, d->sd, n_columns * sizeof(double));
+
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && (rename(tmp_name, file_name) == 0);
+        if (!ok) remove(tmp_name);
+    }
+
+    free(tmp_name);
+
+    return ok;
+}
+
+struct gges_dataset *gges_map_dataset(const char *file_name)
+{
+    int i, j, n_columns;
+    char *base;
+    struct stat st;
+    struct gges_dataset_header *h;
+    struct gges_dataset *d;
+
+    i = open(file_name, O_RDONLY);
+    if (i < 0) return NULL;
+
+    if ((fstat(i, &st) != 0) || (st.st_size < (off_t)sizeof(struct gges_dataset_header))) {
+        close(i);
+        return NULL;
+    }
+
+    /* the mapping is shared and read-only, so that every run using
+     * the file shares the same pages */
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, i, 0);
+    close(i);
+    if (base == MAP_FAILED) return NULL;
+
+    h = (struct gges_dataset_header *)base;
+    if (memcmp(h->magic, GGES_DATASET_MAGIC, sizeof(h->magic)) != 0) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    n_columns = h->n_features + 1;
+    if ((h->byte_order != GGES_DATASET_BYTE_ORDER) ||
+        ((h->value_size != sizeof(float)) && (h->value_size != sizeof(double))) ||
+        (h->size != (uint64_t)st.st_size) ||
+        (h->n_rows < 0) || (h->n_features < 1) || (h->stride < h->n_rows) ||
+        (h->n_folds < 0) || ((h->n_folds > 0) && (h->fold_words != (h->n_rows + 63) / 64)) ||
+        (h->columns % GGES_DATASET_ALIGN != 0) || (h->folds % sizeof(uint64_t) != 0) ||
+        (h->means % sizeof(double) != 0) || (h->sd % sizeof(double) != 0) ||
+        (h->columns + (uint64_t)n_columns * h->stride * h->value_size > h->size) ||
+        (h->folds + (uint64_t)h->n_folds * h->fold_words * sizeof(uint64_t) > h->size) ||
+        (h->means + n_columns * sizeof(double) > h->size) ||
+        (h->sd + n_columns * sizeof(double) > h->size)) {
+        fprintf(stderr, "%s:%d - ERROR: %s is either damaged or was written on an incompatible platform. Quitting...\n",
+                __FILE__, __LINE__, file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    d = ALLOC(1, sizeof(struct gges_dataset), false);
+    d->n_rows = h->n_rows;
+    d->n_features = h->n_features;
+
+    /* the columns are read in place, whatever their type */
+    d->columns = NULL;
+    d->single_columns = NULL;
+    if (h->value_size == sizeof(double)) {
+        d->columns = ALLOC(n_columns, sizeof(double *), false);
+        for (j = 0; j < n_columns; ++j) {
+            d->columns[j] = (double *)(base + h->columns) + (size_t)j * h->stride;
+        }
+    } else {
+        d->single_columns = ALLOC(n_columns, sizeof(float *), false);
+        for (j = 0; j < n_columns; ++j) {
+            d->single_columns[j] = (float *)(base + h->columns) + (size_t)j * h->stride;
+        }
+    }
+    d->stride = h->stride;
+    d->block = 1;
+
+    d->n_folds = h->n_folds;
+    d->fold_words = h->fold_words;
+    d->folds = (h->n_folds > 0) ? (uint64_t *)(base + h->folds) : NULL;
+
+    d->means = (double *)(base + h->means);
+    d->sd = (double *)(base + h->sd);
+    d->mean_rmse = h->mean_rmse;
+
+    d->image = base;
+    d->image_size = st.st_size;
+
+    return d;
+}
+
+bool gges_dataset_in_test(struct gges_dataset *d, int fold, int row)
+{
+    uint64_t *bitmap;
+
+    bitmap = d->folds + (size_t)fold * d->fold_words;
+
+    return (bitmap[row / 64] >> (row % 64)) & 1;
+}
+
+struct gges_dataset *gges_dataset_fold(struct gges_dataset *d, int fold, bool test,
+                                       int block)
+{
+    int i, j, n, *rows;
+    const double *x;
+    const float *f;
+    struct gges_dataset *s;
+
+    if ((fold < 0) || (fold >= d->n_folds)) {
+        fprintf(stderr, "%s:%d - ERROR: fold %d requested, but only %d folds are available. Quitting...\n",
+                __FILE__, __LINE__, fold + 1, d->n_folds);
+        exit(EXIT_FAILURE);
+    }
+
+    rows = ALLOC(d->n_rows + 1, sizeof(int), false);
+    for (n = i = 0; i < d->n_rows; ++i) {
+        if (gges_dataset_in_test(d, fold, i) == test) rows[n++] = i;
+    }
+
+    /* the rows are copied once, column by column, so that the fold is
+     * read in place from then on (the padding is left as zeros) */
+    s = create_dataset(n, d->n_features, block);
+    for (j = 0; j <= d->n_features; ++j) {
+        if (d->columns != NULL) {
+            x = d->columns[j];
+            for (i = 0; i < n; ++i) s->columns[j][i] = x[rows[i]];
+        } else {
+            f = d->single_columns[j];
+            for (i = 0; i < n; ++i) s->columns[j][i] = f[rows[i]];
+        }
+    }
+    free(rows);
+
+    compute_statistics(s);
+
+    return s;
+}
+
+void gges_dataset_read(struct gges_dataset *d, int column, int row, int n,
+                       double *values)
+{
+    int i, m;
+    const float *f;
+
+    m = (row < d->n_rows) ? d->n_rows - row : 0;
+    if (m > n) m = n;
+
+    if (d->columns != NULL) {
+        memcpy(values, d->columns[column] + row, m * sizeof(double));
+    } else {
+        f = d->single_columns[column] + row;
+        for (i = 0; i < m; ++i) values[i] = f[i];
+    }
+
+    for (i = m; i < n; ++i) values[i] = 0;
+}
+
+
+
+
+
+
+
+
+/*******************************************************************************
+ * Private function implementations
+ ******************************************************************************/
+static char *read_file(const char *file_name)
+{
+    FILE *f;
+    char *data;
+    long flen, read;
+
+    f = fopen(file_name, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s:%d - ERROR: Failed to open file %s\n",
+                __FILE__, __LINE__, file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((fseek(f, 0, SEEK_END) != 0) || ((flen = ftell(f)) < 0) ||
+        (fseek(f, 0, SEEK_SET) != 0)) {
+        fprintf(stderr, "%s:%d - ERROR: Could not get the length of file %s\n",
+                __FILE__, __LINE__, file_name);
+        fclose(f);
+        exit(EXIT_FAILURE);
+    }
+
+    data = ALLOC(flen + 1, sizeof(char), false);
+    read = fread(data, 1, flen, f);
+    data[read] = '\0';
+    fclose(f);
+
+    return data;
+}
+
+/* reads the next value from the text, skipping blanks and comments.
+ * Returns false at the end of the text, or at the end of a line (in
+ * which case end_of_line is set) */
+static bool next_value(char **p, double *value, int *line, bool *end_of_line,
+                       const char *file_name)
+{
+    char *s, *end;
+
+    s = *p;
+    *end_of_line = false;
+    while (true) {
+        switch (*s) {
+        case '\0':
+            *p = s;
+            return false;
+        case '\n':
+            (*line)++;
+            *p = s + 1;
+            *end_of_line = true;
+            return false;
+        case ' ': case '\t': case '\r':
+            s++;
+            break;
+        case '#':
+            while ((*s != '\0') && (*s != '\n')) s++;
+            break;
+        default:
+            *value = strtod(s, &end);
+            if (end == s) {
+                fprintf(stderr, "%s:%d - ERROR: unexpected character '%c' on line %d of %s. Quitting...\n",
+                        __FILE__, __LINE__, *s, *line, file_name);
+                exit(EXIT_FAILURE);
+            }
+            *p = end;
+            return true;
+        }
+    }
+}
+
+/* parses the whole data file in a single pass, returning the values
+ * row-major in a buffer that is grown geometrically */
+static double *parse_values(char *text, const char *file_name,
+                            int *n_rows, int *n_cols)
+{
+    char *p;
+    int n, sz, line, rows, cols, row_length;
+    bool end_of_line;
+    double value, *values;
+
+    sz = 1024;
+    values = ALLOC(sz, sizeof(double), false);
+
+    n = rows = cols = row_length = 0;
+    line = 1;
+    p = text;
+    while (true) {
+        if (next_value(&p, &value, &line, &end_of_line, file_name)) {
+            if (n == sz) {
+                sz *= 2;
+                values = REALLOC(values, sz, sizeof(double));
+            }
+            values[n++] = value;
+            row_length++;
+            continue;
+        }
+
+        /* end of a line (or of the file), blank lines are skipped */
+        if (row_length > 0) {
+            if (cols == 0) cols = row_length;
+            if (row_length != cols) {
+                fprintf(stderr, "%s:%d - ERROR: line %d of %s has %d values, but %d were expected. Quitting...\n",
+                        __FILE__, __LINE__, line - (end_of_line ? 1 : 0), file_name, row_length, cols);
+                exit(EXIT_FAILURE);
+            }
+            rows++;
+            row_length = 0;
+        }
+
+        if (!end_of_line) break;
+    }
+
+    *n_rows = rows;
+    *n_cols = cols;
+
+    return values;
+}
+
+/* reads each line of the fold file into a test set bitmap. Folds are
+ * numbered by line, so a blank line is a fold with an empty test set
+ * (only the newline ending the last line does not start another) */
+static void parse_folds(struct gges_dataset *d, char *text, const char *file_name)
+{
+    char *p;
+    int line, sz, row;
+    bool end_of_line;
+    double value;
+    uint64_t *bitmap;
+
+    d->fold_words = (d->n_rows + 63) / 64;
+    sz = 0;
+
+    line = 1;
+    p = text;
+    while (*p != '\0') {
+        if (d->n_folds == sz) {
+            sz = (sz == 0) ? 16 : sz * 2;
+            d->folds = REALLOC(d->folds, sz * d->fold_words, sizeof(uint64_t));
+        }
+        bitmap = d->folds + (size_t)d->n_folds * d->fold_words;
+        memset(bitmap, 0, d->fold_words * sizeof(uint64_t));
+        d->n_folds++;
+
+        while (next_value(&p, &value, &line, &end_of_line, file_name)) {
+            if ((value < 1) || (value > d->n_rows)) {
+                fprintf(stderr, "%s:%d - ERROR: instance %g on line %d of %s is out of range (the data has %d instances). Quitting...\n",
+                        __FILE__, __LINE__, value, line, file_name, d->n_rows);
+                exit(EXIT_FAILURE);
+            }
+            if (value != floor(value)) {
+                fprintf(stderr, "%s:%d - ERROR: instance %g on line %d of %s is not a whole number. Quitting...\n",
+                        __FILE__, __LINE__, value, line, file_name);
+                exit(EXIT_FAILURE);
+            }
+
+            row = (int)value - 1;
+            bitmap[row / 64] |= (uint64_t)1 << (row % 64);
+        }
+    }
+}
+
+static struct gges_dataset *create_dataset(int n_rows, int n_features, int block)
+{
+    struct gges_dataset *d;
+
+    d = ALLOC(1, sizeof(struct gges_dataset), false);
+    d->n_rows = n_rows;
+    d->n_features = n_features;
+    allocate_columns(d, block);
+
+    d->n_folds = 0;
+    d->fold_words = 0;
+    d->folds = NULL;
+
+    d->means = ALLOC(n_features + 1, sizeof(double), false);
+    d->sd = ALLOC(n_features + 1, sizeof(double), false);
+    d->mean_rmse = 0;
+
+    d->image = NULL;
+    d->image_size = 0;
+
+    return d;
+}
+
+/* allocates zeroed columns for the dataset's rows, padded to a
+ * multiple of block rows */
+static void allocate_columns(struct gges_dataset *d, int block)
+{
+    int j;
+
+    if (block < 1) block = 1;
+
+    d->block = block;
+    d->stride = ((d->n_rows + block - 1) / block) * block;
+    if (d->stride == 0) d->stride = block;
+
+    d->single_columns = NULL;
+    d->columns = ALLOC(d->n_features + 1, sizeof(double *), false);
+    d->columns[0] = ALLOC((d->n_features + 1) * d->stride, sizeof(double), true);
+    for (j = 1; j <= d->n_features; ++j) d->columns[j] = d->columns[0] + (size_t)j * d->stride;
+}
+
+/* finds the mean and standard deviation of every column (and the RMSE
+ * of the mean model) with a single pass over the data, using Welford's
+ * method. The values are read a block at a time, so that columns of
+ * floats are handled as well */
+#define GGES_DATASET_READ_BLOCK 256
+
+static void compute_statistics(struct gges_dataset *d)
+{
+    int i, j, k, m, n;
+    double delta, mean, m2, x[GGES_DATASET_READ_BLOCK];
+
+    n = d->n_rows;
+    for (j = 0; j <= d->n_features; ++j) {
+        mean = m2 = 0;
+        for (i = 0; i < n; i += GGES_DATASET_READ_BLOCK) {
+            m = (n - i < GGES_DATASET_READ_BLOCK) ? (n - i) : GGES_DATASET_READ_BLOCK;
+            gges_dataset_read(d, j, i, m, x);
+            for (k = 0; k < m; ++k) {
+                delta = x[k] - mean;
+                mean += delta / (i + k + 1);
+                m2 += delta * (x[k] - mean);
+            }
+        }
+
+        d->means[j] = mean;
+        d->sd[j] = (n < 2) ? 0 : sqrt(m2 / (n - 1));
+        if (j == d->n_features) d->mean_rmse = (n < 1) ? 0 : sqrt(m2 / n);
+    }
+}
+
+static bool in_image(struct gges_dataset *d, void *p)
+{
+    return (d->image != NULL) && ((char *)p >= (char *)d->image) &&
+           ((char *)p < (char *)d->image + d->image_size);
+}
+
+static uint64_t align_offset(uint64_t offset, uint64_t align)
+{
+    return ((offset + align - 1) / align) * align;
+}
+
+/* writes the data at the given offset of the file, filling any gap
+ * since the last write with zeroes */
+static bool write_at(FILE *f, uint64_t *pos, uint64_t offset,
+                     const void *data, size_t n)
+{
+    for (; *pos < offset; (*pos)++) {
+        if (fputc(0, f) == EOF) return false;
+    }
+
+    if ((n > 0) && (fwrite(data, 1, n, f) != n)) return false;
+    *pos += n;
+
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef GGES_DATASET
+#define GGES_DATASET
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    #include <stdbool.h>
+    #include <stdint.h>
+
+    /* a table of numeric data, as used by regression problems. The
+     * data are held column-major, with one column per feature
+     * followed by a column for the response (the last column of the
+     * data file). The values of a mapped dataset may be floats, so
+     * they are best read with gges_dataset_read, which works for
+     * every kind of dataset */
+    struct gges_dataset {
+        int n_rows;
+        int n_features;
+
+        double **columns; /* n_features + 1 columns, each holding
+                           * stride values (the rows beyond n_rows are
+                           * zero), or NULL if the values are floats */
+        float **single_columns; /* the columns, if the values are held
+                                 * as floats (as in a binary dataset
+                                 * written in single precision) */
+        int stride;
+        int block; /* columns are padded to a multiple of this many
+                    * rows */
+
+        /* the test set of each fold, as a bitmap over the rows (with
+         * the training set being every row not in the test set) */
+        int n_folds;
+        int fold_words; /* the number of words in each bitmap */
+        uint64_t *folds;
+
+        /* the mean and (sample) standard deviation of each column,
+         * and the RMSE obtained by predicting the mean response */
+        double *means;
+        double *sd;
+        double mean_rmse;
+
+        /* the mapping of a binary dataset file, if the dataset was
+         * loaded from one. Anything that points into the mapping is
+         * read-only, and is not freed with the dataset */
+        void *image;
+        size_t image_size;
+    };
+
+    /* loads a whitespace-separated data file, with one instance per
+     * line (anything after a # is ignored). If fold_file is not NULL,
+     * then each line of it is read as a fold, listing the (1-based)
+     * indices of the instances in that fold's test set (so fold i is
+     * line i, and a blank line is a fold with no test set). The
+     * columns are padded to a multiple of block rows (a block of less
+     * than one means no padding).
+     *
+     * If data_file is a binary dataset (see gges_write_dataset), then
+     * it is mapped instead, and its own folds are used unless a
+     * fold_file is given */
+    struct gges_dataset *gges_load_dataset(const char *data_file,
+                                           const char *fold_file,
+                                           int block);
+    void gges_release_dataset(struct gges_dataset *d);
+
+    /* writes the dataset (along with its folds and statistics) to a
+     * binary file, holding the columns as floats if single_precision
+     * is true, or as doubles otherwise. Returns false if the file
+     * could not be written */
+    bool gges_write_dataset(struct gges_dataset *d, const char *file_name,
+                            bool single_precision);
+
+    /* maps a binary dataset file read-only, so that concurrent runs
+     * share a single copy of the data. The columns (of floats or
+     * doubles) are used in place, and stay mapped until the dataset
+     * is released. Returns NULL if the file is not a binary dataset */
+    struct gges_dataset *gges_map_dataset(const char *file_name);
+
+    /* returns true if the given row is in the test set of the given
+     * (0-based) fold */
+    bool gges_dataset_in_test(struct gges_dataset *d, int fold, int row);
+
+    /* copies either the test or the training set of the given fold
+     * into a new dataset (which has no folds of its own), keeping the
+     * rows in their original order. Whatever the kind of d, the copy
+     * holds its columns as doubles, each contiguous and padded with
+     * zeros to a multiple of block rows, so that they can be read a
+     * block at a time in place. The copy does not refer to d, which
+     * can be released once the folds have been taken */
+    struct gges_dataset *gges_dataset_fold(struct gges_dataset *d, int fold, bool test,
+                                           int block);
+
+    /* reads n values of the given column, starting from the given
+     * row, into values (as doubles). Rows from n_rows onwards read as
+     * zero, so a whole block can be read at the end of the data */
+    void gges_dataset_read(struct gges_dataset *d, int column, int row, int n,
+                           double *values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdint.h>
 
 #include <string.h>
 
@@ -6,8 +7,13 @@
 #include "ge.h"
 
 #include "alloc.h"
+#include "geometric.h"
 
 #define CODON_INC 1024
+#define CODON_SHRINK 8
+
+/* the address of codon i in the list */
+#define CODON_PTR(list, i) ((char *)(list)->codons + (size_t)(i) * (list)->width)
 
 
 
@@ -17,7 +23,7 @@
 static int map_sequence(struct gges_mapping *m,
                         struct gges_ge_codon_list *l,
                         struct gges_bnf_non_terminal *nt,
-                        int *wraps, int offset);
+                        int *wraps, int offset, int max_length);
 
 static int map_derivation(struct gges_derivation_tree **dest,
                           struct gges_bnf_grammar *g,
@@ -30,6 +36,23 @@ static bool sensible_init(struct gges_ge_codon_list *list,
                           int depth, int min_depth, int max_depth,
                           double (*rnd)(void));
 
+static void append_choice(struct gges_ge_codon_list *list,
+                          struct gges_bnf_production *p,
+                          double (*rnd)(void));
+
+static void append_tail(struct gges_ge_codon_list *list,
+                        double tail_length,
+                        double (*rnd)(void));
+
+static void reserve_codons(struct gges_ge_codon_list *list, int n);
+static void carry_consumed(struct gges_ge_codon_list *o,
+                           struct gges_ge_codon_list *p, int cut);
+
+static inline gges_ge_codon get_codon(struct gges_ge_codon_list *list, int i);
+static inline void set_codon(struct gges_ge_codon_list *list, int i,
+                             gges_ge_codon value);
+static int max_codon_value(int width);
+
 
 
 
@@ -37,18 +60,65 @@ static bool sensible_init(struct gges_ge_codon_list *list,
 /*******************************************************************************
  * Public function implementations
  ******************************************************************************/
-struct gges_ge_codon_list *gges_ge_create_codon_list(void)
+int gges_ge_codon_width(struct gges_bnf_grammar *g, int bits)
+{
+    int i, branching, width;
+
+    /* codons are taken MOD the number of productions of a
+     * non-terminal, so they need to be able to reach the largest of
+     * these */
+    branching = 0;
+    for (i = 0; i < g->size; ++i) {
+        if (g->non_terminals[i].size > branching) branching = g->non_terminals[i].size;
+    }
+
+    if (branching <= max_codon_value(1)) {
+        width = 1;
+    } else if (branching <= max_codon_value(2)) {
+        width = 2;
+    } else {
+        width = sizeof(int);
+    }
+
+    if (bits > 0) {
+        if (bits / 8 < width) {
+            fprintf(stderr, "%s:%d - WARNING: %d-bit codons cannot select all of the %d "
+                    "productions of a non-terminal, using %d-bit codons instead\n",
+                    __FILE__, __LINE__, bits, branching, width * 8);
+        } else if (bits / 8 < (int)sizeof(int)) {
+            width = bits / 8;
+        } else {
+            width = sizeof(int);
+        }
+    }
+
+    return width;
+}
+
+
+
+struct gges_ge_codon_list *gges_ge_create_codon_list(int width)
 {
     struct gges_ge_codon_list *list;
 
     list = ALLOC(1, sizeof(struct gges_ge_codon_list), false);
     list->codons = NULL;
+    list->width = (width == 1 || width == 2) ? width : (int)sizeof(int);
     list->N = 0;
     list->sz = 0;
+    list->consumed = -1;
+    list->wraps = 0;
 
     return list;
 }
 
+
+
+gges_ge_codon gges_ge_codon_value(struct gges_ge_codon_list *list, int i)
+{
+    return get_codon(list, i);
+}
+
 void gges_ge_release_codon_list(struct gges_ge_codon_list *list)
 {
     free(list->codons);
@@ -61,14 +131,15 @@ bool gges_ge_random_init(struct gges_ge_codon_list *list,
                          int codon_count,
                          double (*rnd)(void))
 {
-    int i;
-
-    free(list->codons);
-    list->sz = sizeof(gges_ge_codon) * CODON_INC;
+    int i, max_value;
 
-    list->codons = ALLOC(CODON_INC, sizeof(gges_ge_codon), false);
+    /* the buffer is kept from whatever the list held before, and only
+     * grown if it is too short for the new genome */
+    reserve_codons(list, codon_count);
+    list->consumed = -1;
+    max_value = max_codon_value(list->width);
     for (i = 0; i < codon_count; ++i) {
-        list->codons[i] = (gges_ge_codon)(rnd() * MAX_CODON_VALUE);
+        set_codon(list, i, (gges_ge_codon)(rnd() * max_value));
     }
     list->N = codon_count;
 
@@ -84,7 +155,6 @@ bool gges_ge_sensible_init(struct gges_bnf_grammar *g,
                            double (*rnd)(void))
 {
     struct gges_bnf_non_terminal *start;
-    int tail_codons;
 
     if (g->start == NULL) {
         /* the supplied grammar has no explicitly nominated start
@@ -95,22 +165,11 @@ bool gges_ge_sensible_init(struct gges_bnf_grammar *g,
         start = g->start;
     }
 
-    free(list->codons);
-    list->sz = sizeof(gges_ge_codon) * CODON_INC;
-
-    list->codons = ALLOC(CODON_INC, sizeof(gges_ge_codon), false);
-
     list->N = 0;
+    list->consumed = -1;
     if (sensible_init(list, start, 1, min_depth, max_depth, rnd)) {
         /* add a random tail to the genome, if required */
-        tail_codons = (int)((1 + tail_length) * list->N);
-        while (list->N < tail_codons) {
-            if (list->sz <= (list->N * sizeof(gges_ge_codon))) {
-                list->sz += CODON_INC * sizeof(gges_ge_codon);
-                list->codons = REALLOC(list->codons, 1, list->sz);
-            }
-            list->codons[list->N++] = (gges_ge_codon)(rnd() * MAX_CODON_VALUE);
-        }
+        append_tail(list, tail_length, rnd);
 
         return true;
     } else {
@@ -120,13 +179,59 @@ bool gges_ge_sensible_init(struct gges_bnf_grammar *g,
 
 
 
+bool gges_ge_sized_init(struct gges_bnf_grammar *g,
+                        struct gges_ge_codon_list *list,
+                        int min_size, int max_size,
+                        double tail_length,
+                        double (*rnd)(void))
+{
+    struct gges_bnf_non_terminal *start;
+    struct gges_bnf_production **seq;
+    int i, n;
+
+    if (g->start == NULL) {
+        /* the supplied grammar has no explicitly nominated start
+         * symbol, so we will use the first defined non-terminal as
+         * our starting point */
+        start = g->non_terminals + 0;
+    } else {
+        start = g->start;
+    }
+
+    list->N = 0;
+    list->consumed = -1;
+
+    /* the productions are sampled in the same order that the mapping
+     * process consumes codons, so they can be entered directly */
+    seq = ALLOC(max_size, sizeof(struct gges_bnf_production *), false);
+    n = gges_bnf_sample_derivation(g, start, min_size, max_size, seq, rnd);
+    if (n == 0) {
+        fprintf(stderr, "%s:%d - WARNING: Failed to create a genome, as the grammar "
+                "cannot produce a derivation with between %d and %d "
+                "non-terminal expansions.\n",
+                __FILE__, __LINE__, min_size, max_size);
+        free(seq);
+        return false;
+    }
+
+    for (i = 0; i < n; ++i) append_choice(list, seq[i], rnd);
+    free(seq);
+
+    append_tail(list, tail_length, rnd);
+
+    return true;
+}
+
+
+
 
 bool gges_ge_map_codons(struct gges_bnf_grammar *g,
                         struct gges_ge_codon_list *list,
                         struct gges_mapping *mapping,
-                        int wraps)
+                        int wraps, int max_length)
 {
     struct gges_bnf_non_terminal *start;
+    int offset, wraps_left;
 
     if (g->start == NULL) {
         /* the supplied grammar has no explicitly nominated start
@@ -140,7 +245,38 @@ bool gges_ge_map_codons(struct gges_bnf_grammar *g,
     /* the mapping function will return less than zero if there was a
      * problem decoding the individual, most likely because the codon
      * sequence did not lead to a valid individual */
-    return map_sequence(mapping, list, start, &wraps, 0) >= 0;
+    wraps_left = wraps;
+    offset = map_sequence(mapping, list, start, &wraps_left, 0, max_length);
+
+    list->wraps = wraps - wraps_left;
+    list->consumed = (offset < 0) ? -1 : (list->wraps * list->N + offset);
+
+    return offset >= 0;
+}
+
+
+
+int gges_ge_coding_length(struct gges_ge_codon_list *list)
+{
+    if (list->consumed < 0 || list->consumed > list->N) return list->N;
+    return list->consumed;
+}
+
+
+
+void gges_ge_prune_tail(struct gges_ge_codon_list *list, double slack)
+{
+    int keep;
+
+    if (list->consumed < 0 || list->wraps > 0) return;
+
+    /* at least one codon is kept after the coding region, as the
+     * mapping stops when it reaches the end of the genome, even if
+     * the remaining expansions have only a single production, and
+     * would not need to read another codon */
+    keep = list->consumed + (int)(slack * list->consumed);
+    if (keep <= list->consumed) keep = list->consumed + 1;
+    if (keep < list->N) list->N = keep;
 }
 
 
@@ -171,42 +307,47 @@ struct gges_derivation_tree *gges_ge_derive(struct gges_bnf_grammar *g,
 void gges_ge_reproduction(struct gges_ge_codon_list *p,
                           struct gges_ge_codon_list *o)
 {
-    size_t reqsz;
-
-    reqsz = (p->N * sizeof(gges_ge_codon));
     /* check that the destination buffer for the genome is sufficient,
      * and resize if necessary */
-    if (o->sz < reqsz) {
-        while (o->sz < reqsz) o->sz += CODON_INC * sizeof(gges_ge_codon);
-
-        o->codons = REALLOC(o->codons, 1, o->sz);
-    }
+    o->width = p->width;
+    reserve_codons(o, p->N);
 
     o->N = p->N;
-    memcpy(o->codons, p->codons, reqsz);
+    memcpy(o->codons, p->codons, (size_t)p->N * p->width);
+    o->consumed = p->consumed;
+    o->wraps = p->wraps;
 }
 
 void gges_ge_crossover(struct gges_ge_codon_list *m,
                        struct gges_ge_codon_list *f,
                        struct gges_ge_codon_list *d,
                        struct gges_ge_codon_list *s,
-                       bool fixed_point,
+                       bool fixed_point, bool effective,
                        double (*rnd)(void))
 {
-    int cpm, cpf;
-    size_t newsz;
+    int cpm, cpf, lm, lf;
+
+    /* under effective crossover, the crossover sites are only picked
+     * from within the coding regions of the parents */
+    if (effective) {
+        lm = gges_ge_coding_length(m);
+        lf = gges_ge_coding_length(f);
+    } else {
+        lm = m->N;
+        lf = f->N;
+    }
 
     /* pick crossover sites in the parents */
     if (fixed_point) {
-        if (m->N < f->N) {
-            cpm = (int)(rnd() * m->N);
+        if (lm < lf) {
+            cpm = (int)(rnd() * lm);
         } else {
-            cpm = (int)(rnd() * f->N);
+            cpm = (int)(rnd() * lf);
         }
         cpf = cpm;
     } else {
-        cpm = (int)(rnd() * m->N);
-        cpf = (int)(rnd() * f->N);
+        cpm = (int)(rnd() * lm);
+        cpf = (int)(rnd() * lf);
     }
 
     /* work out the offspring size */
@@ -215,59 +356,75 @@ void gges_ge_crossover(struct gges_ge_codon_list *m,
 
     /* check that the offspring genome buffers are big enough, and
      * resize if needed */
-    newsz = d->N * sizeof(gges_ge_codon);
-    if (newsz > d->sz) {
-        while (d->sz < newsz) d->sz += CODON_INC * sizeof(gges_ge_codon);
-        d->codons = REALLOC(d->codons, 1, d->sz);
-    }
-
-    newsz = s->N * sizeof(gges_ge_codon);
-    if (newsz > s->sz) {
-        while (s->sz < newsz) s->sz += CODON_INC * sizeof(gges_ge_codon);
-        s->codons = REALLOC(s->codons, 1, s->sz);
-    }
+    d->width = s->width = m->width;
+    reserve_codons(d, d->N);
+    reserve_codons(s, s->N);
 
     /* perform the crossover */
-    memcpy(d->codons, m->codons, cpm * sizeof(gges_ge_codon));
-    memcpy(d->codons + cpm, f->codons + cpf,
-           (f->N - cpf) * sizeof(gges_ge_codon));
+    memcpy(d->codons, m->codons, (size_t)cpm * m->width);
+    memcpy(CODON_PTR(d, cpm), CODON_PTR(f, cpf), (size_t)(f->N - cpf) * m->width);
+
+    memcpy(s->codons, f->codons, (size_t)cpf * m->width);
+    memcpy(CODON_PTR(s, cpf), CODON_PTR(m, cpm), (size_t)(m->N - cpm) * m->width);
 
-    memcpy(s->codons, f->codons, cpf * sizeof(gges_ge_codon));
-    memcpy(s->codons + cpf, m->codons + cpm,
-           (m->N - cpm) * sizeof(gges_ge_codon));
+    /* an offspring that keeps the whole coding region of its first
+     * parent (which did not need to wrap) maps exactly as that parent
+     * did, so it consumes the same codons */
+    carry_consumed(d, m, cpm);
+    carry_consumed(s, f, cpf);
 }
 
-void gges_ge_mutation(struct gges_ge_codon_list *list,
-                      double pm, double (*rnd)(void))
+/* returns the position of the first mutated codon (or the length of
+ * the list if no codon was mutated) */
+int gges_ge_mutation(struct gges_ge_codon_list *list,
+                     double pm, double (*rnd)(void))
 {
-    int i;
-
-    for (i = 0; i < list->N; ++i) {
-        if (rnd() < pm) {
-            list->codons[i] = (gges_ge_codon)(rnd() * MAX_CODON_VALUE);
-        }
+    int i, max_value, first;
+    double log_q;
+
+    if (pm <= 0) return list->N;
+
+    /* rather than testing every codon against pm, jump straight from
+     * one mutated codon to the next */
+    log_q = (pm < 1) ? log(1 - pm) : 0;
+    max_value = max_codon_value(list->width);
+    first = list->N;
+    for (i = geometric_gap(log_q, list->N, rnd); i < list->N;
+         i += 1 + geometric_gap(log_q, list->N, rnd)) {
+        set_codon(list, i, (gges_ge_codon)(rnd() * max_value));
+        if (first == list->N) first = i;
     }
+
+    return first;
 }
 
-bool gges_ge_breed(struct gges_ge_codon_list *m,
+void gges_ge_breed(struct gges_ge_codon_list *m,
                    struct gges_ge_codon_list *f,
                    struct gges_ge_codon_list *d,
                    struct gges_ge_codon_list *s,
-                   bool fixed_point,
+                   bool fixed_point, bool effective,
                    double pc, double pm,
-                   double (*rnd)(void))
+                   double (*rnd)(void),
+                   bool *d_neutral, bool *s_neutral)
 {
     if (rnd() < pc) {
-        gges_ge_crossover(m, f, d, s, fixed_point, rnd);
+        gges_ge_crossover(m, f, d, s, fixed_point, effective, rnd);
     } else {
         gges_ge_reproduction(m, d);
         gges_ge_reproduction(f, s);
     }
 
-    gges_ge_mutation(d, pm, rnd);
-    gges_ge_mutation(s, pm, rnd);
-
-    return false;
+    /* the consumed count of each offspring is only still known if
+     * none of the codons that it reads were mutated */
+    if (gges_ge_mutation(d, pm, rnd) < gges_ge_coding_length(d)) d->consumed = -1;
+    if (gges_ge_mutation(s, pm, rnd) < gges_ge_coding_length(s)) s->consumed = -1;
+
+    /* an offspring only keeps the mapping of its parent if it is
+     * certain to map in the same way, which is not the case if the
+     * mapping read beyond the end of the genome (by wrapping, or if
+     * the genome has since been pruned back past its coding region) */
+    *d_neutral = (d->consumed >= 0) && (d->consumed <= d->N);
+    *s_neutral = (s->consumed >= 0) && (s->consumed <= s->N);
 }
 
 
@@ -285,13 +442,16 @@ bool gges_ge_breed(struct gges_ge_codon_list *m,
 static int map_sequence(struct gges_mapping *m,
                         struct gges_ge_codon_list *l,
                         struct gges_bnf_non_terminal *nt,
-                        int *wraps, int offset)
+                        int *wraps, int offset, int max_length)
 {
     int i;
     struct gges_bnf_production *p;
 
     if (offset < 0) return -1;
 
+    /* the phenotype has grown too long to be worth evaluating */
+    if (max_length > 0 && m != NULL && m->l > max_length) return -1;
+
     /* fix the wrapping, if we have run out of codons in the current genome */
     if (offset == l->N) {
         if (*wraps == 0) return -1; /* failed to decode properly */
@@ -306,7 +466,7 @@ static int map_sequence(struct gges_mapping *m,
     } else {
         /* use the MOD operator to work out the next required
          * production */
-        p = nt->productions + (l->codons[offset] % nt->size);
+        p = nt->productions + (get_codon(l, offset) % nt->size);
 
         /* we have consumed a codon, so increment the pointer */
         offset++;
@@ -322,7 +482,8 @@ static int map_sequence(struct gges_mapping *m,
              * further expansion. We do this via a recursive call to
              * the relevant production of the corresponding
              * non-terminal */
-            offset = map_sequence(m, l, p->tokens[i].nt, wraps, offset);
+            offset = map_sequence(m, l, p->tokens[i].nt, wraps, offset, max_length);
+            if (offset < 0) return -1;
         }
     }
 
@@ -361,7 +522,7 @@ static int map_derivation(struct gges_derivation_tree **dest,
     } else {
         /* use the MOD operator to work out the next required
          * production */
-        p = nt->productions + (list->codons[offset] % nt->size);
+        p = nt->productions + (get_codon(list, offset) % nt->size);
 
         /* we have consumed a codon, so increment the pointer */
         offset++;
@@ -456,23 +617,7 @@ static bool sensible_init(struct gges_ge_codon_list *list,
          * "unmod" it and insert into the genome so that it can be
          * looked up later when the genotype needs to be mapped */
         p = choices[(int)(rnd() * np)];
-
-        if (nt->size > 1) {
-            /* in this case, there is more than one available
-             * production, so we need to enter the choice into the
-             * genome in an "unmodded" form */
-
-            /* first, make sure that there is available space for the
-             * codon, and if not, then expand the individuals genome
-             * to handle it */
-            if (list->sz < ((list->N + 1) * sizeof(gges_ge_codon))) {
-                list->sz += CODON_INC * sizeof(gges_ge_codon);
-                list->codons = REALLOC(list->codons, 1, list->sz);
-            }
-
-            i = MAX_CODON_VALUE / nt->size;
-            list->codons[list->N++] = p->id + (nt->size * (int)(rnd() * i));
-        }
+        append_choice(list, p, rnd);
 
         /* now that we have a valid production, scan through all its
          * tokens, and for any non-terminals, recursively call the
@@ -492,3 +637,124 @@ static bool sensible_init(struct gges_ge_codon_list *list,
 
     return success;
 }
+
+
+
+/* enters the choice of production into the genome, in an "unmodded"
+ * form so that it can be looked up later when the genotype needs to
+ * be mapped */
+static void append_choice(struct gges_ge_codon_list *list,
+                          struct gges_bnf_production *p,
+                          double (*rnd)(void))
+{
+    int range;
+
+    /* if there is only one available production, then no codon is
+     * consumed by the choice */
+    if (p->nt->size == 1) return;
+
+    /* first, make sure that there is available space for the codon,
+     * and if not, then expand the individuals genome to handle it */
+    reserve_codons(list, list->N + 1);
+
+    range = max_codon_value(list->width) / p->nt->size;
+    set_codon(list, list->N++, p->id + (p->nt->size * (int)(rnd() * range)));
+}
+
+
+
+/* extends the genome with random codons, by the given proportion of
+ * its current length */
+static void append_tail(struct gges_ge_codon_list *list,
+                        double tail_length,
+                        double (*rnd)(void))
+{
+    int tail_codons, max_value;
+
+    tail_codons = (int)((1 + tail_length) * list->N);
+    reserve_codons(list, tail_codons);
+    max_value = max_codon_value(list->width);
+    while (list->N < tail_codons) {
+        set_codon(list, list->N++, (gges_ge_codon)(rnd() * max_value));
+    }
+}
+
+
+
+/* sets the consumed count of an offspring that starts with the first
+ * cut codons of parent p, which is the same as that of p if the cut
+ * is beyond the codons read when mapping p */
+static void carry_consumed(struct gges_ge_codon_list *o,
+                           struct gges_ge_codon_list *p, int cut)
+{
+    if (p->consumed >= 0 && p->wraps == 0 && p->consumed <= cut) {
+        o->consumed = p->consumed;
+        o->wraps = 0;
+    } else {
+        o->consumed = -1;
+    }
+}
+
+
+
+/* makes sure that the list has room for at least n codons (keeping
+ * the first n codons that it holds). Buffers grow geometrically
+ * (starting from CODON_INC codons), so an individual that is reused
+ * from generation to generation soon stops needing any allocation at
+ * all. A buffer that has become more than CODON_SHRINK times larger
+ * than needed (e.g., after a bloated ancestor) is cut back to twice
+ * the required size, so that the population does not keep the memory
+ * of its largest ever genomes */
+static void reserve_codons(struct gges_ge_codon_list *list, int n)
+{
+    size_t reqsz, minsz;
+
+    reqsz = (size_t)n * list->width;
+    minsz = (size_t)CODON_INC * list->width;
+
+    if (list->sz >= reqsz) {
+        if ((list->sz <= minsz) || (list->sz / CODON_SHRINK <= reqsz)) return;
+
+        list->sz = (2 * reqsz > minsz) ? 2 * reqsz : minsz;
+    } else {
+        if (list->sz < minsz) list->sz = minsz;
+        while (list->sz < reqsz) list->sz *= 2;
+    }
+
+    list->codons = REALLOC(list->codons, 1, list->sz);
+}
+
+
+
+static inline gges_ge_codon get_codon(struct gges_ge_codon_list *list, int i)
+{
+    switch (list->width) {
+    case 1:  return ((uint8_t *)list->codons)[i];
+    case 2:  return ((uint16_t *)list->codons)[i];
+    default: return ((gges_ge_codon *)list->codons)[i];
+    }
+}
+
+
+
+static inline void set_codon(struct gges_ge_codon_list *list, int i,
+                             gges_ge_codon value)
+{
+    switch (list->width) {
+    case 1:  ((uint8_t *)list->codons)[i] = (uint8_t)value; break;
+    case 2:  ((uint16_t *)list->codons)[i] = (uint16_t)value; break;
+    default: ((gges_ge_codon *)list->codons)[i] = value; break;
+    }
+}
+
+
+
+/* codon values lie in [0, max_codon_value(width)) */
+static int max_codon_value(int width)
+{
+    switch (width) {
+    case 1:  return UINT8_MAX;
+    case 2:  return UINT16_MAX;
+    default: return INT_MAX;
+    }
+}
@@ -12,9 +12,10 @@ extern "C" {
     #include "derivation.h"
     #include "mapping.h"
 
-    /* defines the data type used for codons in the GE system. */
-    #define MAX_CODON_VALUE INT_MAX
-    /* #define MAX_CODON_VALUE 255 */
+    /* defines the data type used for codon values in the GE
+     * system. Codons are stored in 8, 16 or 32 bits, as chosen when
+     * the codon list is created, but are always handled as this
+     * type */
     typedef int gges_ge_codon;
 
     struct gges_ge_codon_list {
@@ -22,24 +23,59 @@ extern "C" {
          * variable-length list of integers (a bitstring is also used
          * in the earlier work for GE, but this appears to be optional
          * in later work */
-        gges_ge_codon *codons;
+        void *codons;
+        int width; /* the number of bytes used to store each codon (1,
+                    * 2 or 4), codon values lie in [0, 255), [0,
+                    * 65535) or [0, INT_MAX) respectively */
         int N; /* the number of codons used */
         size_t sz; /* the size of the buffer to hold the codons */
+
+        int consumed; /* the number of codons read when mapping the
+                       * list (counting every pass over the genome if
+                       * it wrapped), as found by the last successful
+                       * mapping or carried through breeding, or -1
+                       * if this is not known */
+        int wraps;    /* the number of times that the last mapping
+                       * wrapped around the genome */
     };
 
-    struct gges_ge_codon_list *gges_ge_create_codon_list(void);
+    /* returns the narrowest codon width (in bytes) that can select
+     * every production of the grammar, or the width for the given
+     * number of bits if that is wide enough (a bits of zero picks the
+     * narrowest width) */
+    int gges_ge_codon_width(struct gges_bnf_grammar *g, int bits);
+
+    /* creates an empty codon list, storing codons in width bytes
+     * each (with anything other than 1 or 2 meaning a full int) */
+    struct gges_ge_codon_list *gges_ge_create_codon_list(int width);
     void gges_ge_release_codon_list(struct gges_ge_codon_list *list);
 
+    /* returns the value of codon i in the list */
+    gges_ge_codon gges_ge_codon_value(struct gges_ge_codon_list *list, int i);
+
 
     /* runs the process that maps the codon list into the
-     * corresponding executable code via the supplied grammar
+     * corresponding executable code via the supplied grammar. If
+     * max_length is greater than zero, then mapping is abandoned as
+     * soon as the phenotype grows longer than max_length characters
      *
      * returns true if the mapping process was successful, otherwise
      * false */
     bool gges_ge_map_codons(struct gges_bnf_grammar *g,
                             struct gges_ge_codon_list *list,
                             struct gges_mapping *mapping,
-                            int wraps);
+                            int wraps, int max_length);
+
+    /* returns the length of the coding region of the list (i.e., the
+     * leading codons that were read by the last mapping), which is
+     * the whole list if this is not known */
+    int gges_ge_coding_length(struct gges_ge_codon_list *list);
+
+    /* drops the non-coding tail of a mapped list, keeping at most
+     * slack times the coding length in extra codons after the coding
+     * region (but always at least one, so that the list still maps
+     * to the same phenotype) */
+    void gges_ge_prune_tail(struct gges_ge_codon_list *list, double slack);
 
     /* uses a simple initialisation method that generates a required
      * number of random codon values. The last parameter is a
@@ -58,6 +94,20 @@ extern "C" {
                                int min_depth, int max_depth,
                                double tail_length,
                                double (*rnd)(void));
+
+    /* initialises the genome by sampling uniformly from all the
+     * derivation trees that the grammar can produce with a size
+     * (i.e., number of expanded non-terminals) in [min_size,
+     * max_size], and then working back to the corresponding codons
+     * (plus a random tail, as per sensible initialisation). The last
+     * parameter is a pseudorandom number generator function pointer
+     * that returns values in [0,1) */
+    bool gges_ge_sized_init(struct gges_bnf_grammar *g,
+                            struct gges_ge_codon_list *list,
+                            int min_size, int max_size,
+                            double tail_length,
+                            double (*rnd)(void));
+
     struct gges_derivation_tree *gges_ge_derive(struct gges_bnf_grammar *g,
                                                 struct gges_ge_codon_list *list,
                                                 int wraps);
@@ -65,13 +115,19 @@ extern "C" {
     void gges_ge_reproduction(struct gges_ge_codon_list *p,
                               struct gges_ge_codon_list *o);
 
-    bool gges_ge_breed(struct gges_ge_codon_list *m,
+    /* breeds the offspring d and s from the parents m and f. Neutral
+     * offspring (those that only differ from their first parent in
+     * codons that are never read in mapping, and so map exactly as
+     * that parent does) are flagged through d_neutral and
+     * s_neutral */
+    void gges_ge_breed(struct gges_ge_codon_list *m,
                        struct gges_ge_codon_list *f,
                        struct gges_ge_codon_list *d,
                        struct gges_ge_codon_list *s,
-                       bool fixed_point,
+                       bool fixed_point, bool effective,
                        double pc, double pm,
-                       double (*rnd)(void));
+                       double (*rnd)(void),
+                       bool *d_neutral, bool *s_neutral);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,34 @@
+#ifndef _GGES_GEOMETRIC_H
+#define	_GGES_GEOMETRIC_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    #include <math.h>
+
+    /* for an operator that acts on each position of a genome with
+     * probability p, returns the number of positions to skip before
+     * the next one that is acted upon. This follows a geometric
+     * distribution, so only one random number is needed for each
+     * position acted upon, rather than one for every position. log_q
+     * is log(1 - p), or zero if p is one (the caller needs to deal
+     * with a p of zero), and the result is never larger than
+     * limit */
+    static inline int geometric_gap(double log_q, int limit, double (*rnd)(void))
+    {
+        double gap;
+
+        if (log_q == 0) return 0;
+
+        /* rnd() is in [0, 1), so the log is never of zero */
+        gap = log(1.0 - rnd()) / log_q;
+
+        return (gap < limit) ? (int)gap : limit;
+    }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
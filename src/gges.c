@@ -5,6 +5,8 @@
 
 #include "gges.h"
 #include "individual.h"
+#include "ge.h"
+#include "sge.h"
 
 #include "alloc.h"
 
@@ -46,6 +48,8 @@ static int compare_individuals(const void *a, const void *b)
 static struct gges_population *create_population(struct gges_parameters *params)
 {
     struct gges_population *pop;
+    struct gges_sge_genome **genomes;
+    int i;
 
     pop = ALLOC(1, sizeof(struct gges_population), false);
     pop->members = ALLOC(params->population_size, sizeof(struct gges_individual *), false);
@@ -55,6 +59,19 @@ static struct gges_population *create_population(struct gges_parameters *params)
         pop->members[pop->N++] = gges_create_individual(params);
     }
 
+    /* fixed-size SGE genomes all share one layout, so they are kept
+     * as the rows of a single matrix */
+    pop->grammar = NULL;
+    pop->owns_grammar = false;
+
+    pop->sge_genes = NULL;
+    if ((params->model == STRUCTURED_GRAMMATICAL_EVOLUTION) && (params->sge_layout != NULL)) {
+        genomes = ALLOC(pop->N, sizeof(struct gges_sge_genome *), false);
+        for (i = 0; i < pop->N; ++i) genomes[i] = pop->members[i]->representation.genome;
+        pop->sge_genes = gges_sge_create_genome_matrix(params->sge_layout, genomes, pop->N);
+        free(genomes);
+    }
+
     return pop;
 }
 
@@ -315,7 +332,7 @@ static void generational_model(struct gges_parameters *params,
         if (gen->members[i]->mapped && (!gen->members[i]->evaluated || !params->cache_fitness)) {
             gen->members[i]->fitness = evaluator(params, gen->members[i], args);
             gen->members[i]->evaluated = true;
-        } else {
+        } else if (!gen->members[i]->mapped) {
             gen->members[i]->fitness = GGES_WORST_FITNESS;
             gen->members[i]->evaluated = false;
         }
@@ -358,18 +375,18 @@ static void steady_state_model(struct gges_parameters *params,
          * successfully mapped, and they have not been evaluated
          * already (i.e., they are not straight copies of their
          * parents) */
-        if (daughter->mapped && !daughter->evaluated) {
+        if (daughter->mapped && (!daughter->evaluated || !params->cache_fitness)) {
             daughter->fitness = evaluator(params, daughter, args);
             daughter->evaluated = true;
-        } else {
+        } else if (!daughter->mapped) {
             daughter->fitness = GGES_WORST_FITNESS;
             daughter->evaluated = false;
         }
 
-        if (son->mapped && !son->evaluated) {
+        if (son->mapped && (!son->evaluated || !params->cache_fitness)) {
             son->fitness = evaluator(params, son, args);
             son->evaluated = true;
-        } else {
+        } else if (!son->mapped) {
             son->fitness = GGES_WORST_FITNESS;
             son->evaluated = false;
         }
@@ -461,8 +478,40 @@ struct gges_population *gges_run_system(struct gges_parameters *params,
                                         void *args)
 {
     struct gges_population *pop, *gen, *tmp;
+    struct gges_bnf_grammar *unrolled;
     int g;
 
+    /* SGE needs a non-recursive grammar, so unroll the supplied one
+     * if asked to (the members are derived from the unrolled grammar,
+     * so it is handed over to the final population) */
+    unrolled = NULL;
+    if ((params->model == STRUCTURED_GRAMMATICAL_EVOLUTION) && (params->sge_recursion_depth > 0)) {
+        unrolled = gges_unroll_grammar(grammar, params->sge_recursion_depth);
+        if (unrolled == NULL) {
+            fprintf(stderr, "%s:%d - ERROR! Could not unroll the grammar to a "
+                    "recursion depth of %d (see sge_recursion_depth)\n",
+                    __FILE__, __LINE__, params->sge_recursion_depth);
+            exit(EXIT_FAILURE);
+        }
+        grammar = unrolled;
+    }
+
+    /* the SGE gene sizes only depend on the grammar, so they are
+     * worked out once up front (and are kept on the grammar), rather
+     * than when the first individual is initialised */
+    if ((params->model == STRUCTURED_GRAMMATICAL_EVOLUTION) && (params->sge_gene_sizes == NULL)) {
+        params->sge_genome_size = gges_sge_compute_gene_sizes(grammar, &(params->sge_gene_sizes));
+    }
+    if ((params->model == STRUCTURED_GRAMMATICAL_EVOLUTION) && !params->sge_dynamic_genome
+        && (params->sge_layout == NULL)) {
+        params->sge_layout = gges_sge_create_layout(grammar->size, params->sge_gene_sizes);
+    }
+
+    /* GE codons are only as wide as the grammar needs */
+    if (params->model == GRAMMATICAL_EVOLUTION) {
+        params->codon_width = gges_ge_codon_width(grammar, params->codon_bits);
+    }
+
     /* create initial population */
     pop = create_population(params);
     gen = create_population(params);
@@ -524,6 +573,13 @@ struct gges_population *gges_run_system(struct gges_parameters *params,
      * NULL if we're not using SGE, so a blanket call to free won't do
      * any harm */
     free(params->sge_gene_sizes);
+    params->sge_gene_sizes = NULL;
+    gges_sge_release_layout(params->sge_layout); /* the genomes of pop
+                                                  * keep it alive */
+    params->sge_layout = NULL;
+
+    pop->grammar = grammar;
+    pop->owns_grammar = (unrolled != NULL);
 
     return pop;
 }
@@ -534,7 +590,9 @@ void gges_release_population(struct gges_population *pop)
     if (pop == NULL) return;
 
     while (pop->N--) gges_release_individual(pop->members[pop->N]);
+    free(pop->sge_genes);
     free(pop->members);
+    if (pop->owns_grammar) gges_release_grammar(pop->grammar);
     free(pop);
 }
 
@@ -586,20 +644,33 @@ struct gges_parameters *gges_default_parameters(void)
     def->init_min_depth = 0;
     def->init_max_depth = 6;
 
+    def->init_min_size = 0; /* exact-size sampling is disabled by default */
+    def->init_max_size = 0;
+
     def->init_codon_count_min = -1; /* use fixed initial codon count */
     def->init_codon_count = 200;
 
     def->sensible_init_tail_length = 0.5; /* this comes from GEVA */
 
     def->mapping_wrap_count = 0;
+    def->codon_bits = 0; /* as narrow as the grammar allows */
+    def->codon_width = 0;
+    def->maximum_phenotype_length = 0;
 
     def->fixed_point_crossover = false;
+    def->effective_crossover = false;
+    def->tail_prune_slack = -1; /* no pruning */
     def->node_selection_method = PICK_NODE_KOZA_90_10;
     def->maximum_tree_depth = 17;
+    def->maximum_tree_size = 0;
     def->maximum_mutation_depth = 4;
+    def->mutation_method = SUBTREE_MUTATION;
 
     def->sge_gene_sizes = NULL;
     def->sge_genome_size = 0;
+    def->sge_layout = NULL;
+    def->sge_recursion_depth = 0;
+    def->sge_dynamic_genome = false;
 
     def->rnd = rnd;
 
@@ -1,11 +1,20 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <ctype.h>
+#include <math.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "grammar.h"
+#include "sge.h"
 
 #include "alloc.h"
 
@@ -14,23 +23,91 @@
  * internal helper function prototypes
  ******************************************************************************/
 static long file_length(const char *file_name);
+static char *read_file(const char *file_name);
 
 static const char *read_token(const char *s, char **token);
 static void write_token(FILE *f, const char *s);
+static void append_token(struct gges_bnf_production *p, const char *token);
+
+static struct gges_bnf_non_terminal *create_non_terminal(
+    struct gges_bnf_grammar *g, const char *label);
+static struct gges_bnf_production *create_production(
+    struct gges_bnf_non_terminal *nt);
 
 static void process_token(struct gges_bnf_grammar *g,
                           struct gges_bnf_non_terminal **current_nt,
                           struct gges_bnf_production **current_p,
                           const char *current_token, const char *next_token);
 
-static void link_non_terminal_tokens(struct gges_bnf_grammar *g);
-static void calculate_production_recursion(struct gges_bnf_grammar *g);
-static void calculate_production_depths(struct gges_bnf_grammar *g);
-static void calculate_non_terminal_depths(struct gges_bnf_grammar *g);
+static void link_non_terminal_tokens(struct gges_bnf_grammar *g, bool all);
+static bool *find_affected_non_terminals(struct gges_bnf_grammar *g);
+static struct gges_bnf_non_terminal *next_non_terminal_token(
+    struct gges_bnf_non_terminal *nt, int *j, int *k);
+static int find_components(struct gges_bnf_grammar *g, const bool *affected,
+                           int *component, int *order);
+static bool uses_non_terminal(struct gges_bnf_non_terminal *nt,
+                              struct gges_bnf_non_terminal *target);
+static void calculate_production_recursion(struct gges_bnf_grammar *g,
+                                           const bool *affected);
+static void calculate_production_depths(struct gges_bnf_grammar *g,
+                                        const bool *affected);
+static void calculate_non_terminal_depths(struct gges_bnf_grammar *g,
+                                          const bool *affected);
 
 static struct gges_bnf_non_terminal *lookup_non_terminal(
         struct gges_bnf_grammar *g, const char *label);
 
+static struct gges_bnf_data_field_gen *register_generator(
+        struct gges_bnf_grammar *g, const char *key,
+        enum gges_bnf_data_field_type type);
+
+static const char *non_terminal_label(struct gges_bnf_grammar *g, int i);
+static const char *data_field_gen_key(struct gges_bnf_grammar *g, int i);
+
+static int find_symbol(struct gges_bnf_grammar *g,
+                       struct gges_bnf_symbol_index *index,
+                       const char *(*name)(struct gges_bnf_grammar *, int),
+                       const char *key);
+static void insert_symbol(struct gges_bnf_grammar *g,
+                          struct gges_bnf_symbol_index *index,
+                          const char *(*name)(struct gges_bnf_grammar *, int),
+                          int pos);
+
+static char *unrolled_label(const char *label, int level);
+static int unrolled_node(int *component, int levels, int node,
+                         struct gges_bnf_non_terminal *child);
+static bool keep_unrolled_production(struct gges_bnf_production *p,
+                                     int *component, int levels,
+                                     int node, bool *live);
+static bool *find_unrolled_live_nodes(struct gges_bnf_grammar *g,
+                                      int *component, bool *cyclic,
+                                      int levels);
+static void append_copied_token(struct gges_bnf_production *p,
+                                const struct gges_bnf_token *t,
+                                const char *symbol);
+
+static void begin_modification(struct gges_bnf_grammar *g);
+static char *copy_string(const char *s);
+static void detach_image(struct gges_bnf_grammar *g);
+
+static size_t image_append(char **image, size_t *size, size_t *capacity,
+                           const void *data, size_t n, size_t align);
+static void *image_offset(size_t offset);
+static void *relocate(char *base, void *offset);
+static bool valid_range(size_t size, size_t *end, uint64_t offset, size_t n, size_t align);
+static bool valid_offset(size_t size, void *offset);
+static bool valid_flag(const bool *flag);
+static bool valid_string(const char *base, size_t size, const char *s);
+static bool valid_image(const char *base, size_t size);
+
+static void build_size_counts(struct gges_bnf_grammar *g, int max_size);
+static void release_size_counts(struct gges_bnf_grammar *g);
+static double log_add(double a, double b);
+static void sample_derivation(struct gges_bnf_grammar *g,
+                              struct gges_bnf_non_terminal *nt, int size,
+                              struct gges_bnf_production **seq, int *pos,
+                              double (*rnd)(void));
+
 
 
 
@@ -50,9 +127,27 @@ struct gges_bnf_grammar *gges_create_empty_grammar(void)
     g->non_terminals = NULL;
     g->start = NULL;
 
+    g->nt_index.slots = NULL;
+    g->nt_index.size = 0;
+    g->nt_index.count = 0;
+
+    g->linked = 0;
+
     g->data_field_gen_n = 0;
-    g->data_field_gen_keys = NULL;
-    g->data_field_gen_fn = NULL;
+    g->data_field_gens = NULL;
+
+    g->data_field_gen_index.slots = NULL;
+    g->data_field_gen_index.size = 0;
+    g->data_field_gen_index.count = 0;
+
+    g->size_counts = NULL;
+
+    g->sge_gene_sizes = NULL;
+    g->sge_genome_size = 0;
+
+    g->image = NULL;
+    g->image_size = 0;
+    g->detached = false;
 
     return g;
 }
@@ -61,47 +156,79 @@ struct gges_bnf_grammar *gges_create_empty_grammar(void)
 
 void gges_register_data_field_generator(struct gges_bnf_grammar *g, char *key, gges_bnf_data_field_generator fn)
 {
-    int i;
+    struct gges_bnf_data_field_gen *gen;
 
-    for (i = 0; i < g->data_field_gen_n; ++i) {
-        if (strcmp(g->data_field_gen_keys[i], key) == 0) {
-            /* field already exists, so overwrite the current function pointer */
-            g->data_field_gen_fn[i] = fn;
-            return;
-        }
-    }
+    gen = register_generator(g, key, GGES_DATA_FIELD_STRING);
+    gen->fn.s = fn;
+}
 
-    i = g->data_field_gen_n++;
-    g->data_field_gen_keys = REALLOC(g->data_field_gen_keys, g->data_field_gen_n, sizeof(char *));
-    g->data_field_gen_fn = REALLOC(g->data_field_gen_fn, g->data_field_gen_n, sizeof(gges_bnf_data_field_generator));
 
-    g->data_field_gen_keys[i] = ALLOC((strlen(key) + 1), sizeof(char), false);
-    strcpy(g->data_field_gen_keys[i], key);
-    g->data_field_gen_fn[i] = fn;
+
+void gges_register_double_field_generator(struct gges_bnf_grammar *g, char *key, gges_bnf_double_field_generator fn)
+{
+    struct gges_bnf_data_field_gen *gen;
+
+    gen = register_generator(g, key, GGES_DATA_FIELD_DOUBLE);
+    gen->fn.d = fn;
+}
+
+
+
+void gges_register_int_field_generator(struct gges_bnf_grammar *g, char *key, gges_bnf_int_field_generator fn)
+{
+    struct gges_bnf_data_field_gen *gen;
+
+    gen = register_generator(g, key, GGES_DATA_FIELD_INT);
+    gen->fn.i = fn;
 }
 
+
+
 struct gges_bnf_grammar *gges_load_bnf(const char *file_name)
 {
-    FILE *f;
     char *data;
-    long flen, read;
     struct gges_bnf_grammar *g;
 
-    flen = file_length(file_name);
+    data = read_file(file_name);
+    g = gges_parse_bnf(data);
 
-    f = fopen(file_name, "r");
-    if (f == NULL) {
-        fprintf(stderr, "%s:%d - ERROR: Failed to open file %s\n",
-                __FILE__, __LINE__, file_name);
-        exit(EXIT_FAILURE);
-    }
+    free(data);
+    return g;
+}
 
-    data = ALLOC(flen + 1, sizeof(char), false);
-    read = fread(data, 1, flen, f);
-    data[read] = '\0';
-    fclose(f);
 
-    g = gges_parse_bnf(data);
+
+struct gges_bnf_grammar *gges_load_bnf_cached(const char *file_name,
+                                              const char *cache_name)
+{
+    int i, *gene_sizes;
+    char *data;
+    uint64_t hash;
+    struct gges_bnf_grammar *g;
+
+    if (cache_name == NULL) return gges_load_bnf(file_name);
+
+    data = read_file(file_name);
+    hash = gges_bnf_source_hash(data);
+
+    g = gges_load_compiled_grammar(cache_name, hash);
+    if (g == NULL) {
+        g = gges_parse_bnf(data);
+
+        /* the SGE gene sizes are stored with the grammar, so are
+         * worked out now (they only exist for non-recursive grammars,
+         * with recursive grammars being unrolled at run time) */
+        for (i = 0; (i < g->size) && !g->non_terminals[i].recursive; ++i);
+        if ((g->size > 0) && (i == g->size)) {
+            gges_sge_compute_gene_sizes(g, &gene_sizes);
+            free(gene_sizes);
+        }
+
+        if (!gges_write_compiled_grammar(g, cache_name, hash)) {
+            fprintf(stderr, "%s:%d - Warning! Failed to write compiled grammar %s\n",
+                    __FILE__, __LINE__, cache_name);
+        }
+    }
 
     free(data);
     return g;
@@ -109,6 +236,272 @@ struct gges_bnf_grammar *gges_load_bnf(const char *file_name)
 
 
 
+/* a compiled grammar file is a header followed by an image of the
+ * non-terminal, production and token arrays (and their strings), in
+ * which every pointer is held as an offset from the start of the
+ * file. The layout sizes catch files written by an incompatible build
+ * of the library (e.g., for a different platform) */
+#define GGES_COMPILED_MAGIC "GGESBNF1"
+#define GGES_IMAGE_ALIGN 8
+
+struct gges_compiled_header {
+    char magic[8];
+    uint32_t layout[4];
+    uint64_t source_hash;
+    uint64_t size;
+
+    uint64_t non_terminals;
+    uint64_t slots;
+    uint64_t gene_sizes;
+
+    int32_t n_non_terminals;
+    int32_t start;
+    int32_t index_size;
+    int32_t index_count;
+    int32_t genome_size;
+};
+
+bool gges_write_compiled_grammar(struct gges_bnf_grammar *g,
+                                 const char *file_name,
+                                 uint64_t source_hash)
+{
+    int i, j, k;
+    char *image, *tmp_name;
+    size_t size, capacity, nts, prods, toks, off, *labels;
+    bool ok;
+    FILE *f;
+    struct gges_compiled_header h;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+    struct gges_bnf_token *t;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, GGES_COMPILED_MAGIC, sizeof(h.magic));
+    h.layout[0] = sizeof(void *);
+    h.layout[1] = sizeof(struct gges_bnf_non_terminal);
+    h.layout[2] = sizeof(struct gges_bnf_production);
+    h.layout[3] = sizeof(struct gges_bnf_token);
+    h.source_hash = source_hash;
+
+    image = NULL;
+    size = capacity = 0;
+    image_append(&image, &size, &capacity, &h, sizeof(h), GGES_IMAGE_ALIGN);
+
+    /* the arrays are copied in as they are, and then each pointer is
+     * overwritten with the offset of its target. The image can move
+     * as it grows, so everything is addressed by offset while
+     * writing. The labels go in first, as the symbol of each
+     * non-terminal token is the same string as its label */
+    nts = image_append(&image, &size, &capacity, g->non_terminals,
+                       g->size * sizeof(struct gges_bnf_non_terminal), GGES_IMAGE_ALIGN);
+    labels = ALLOC(g->size, sizeof(size_t), false);
+    for (i = 0; i < g->size; ++i) {
+        nt = g->non_terminals + i;
+        labels[i] = image_append(&image, &size, &capacity, nt->label, strlen(nt->label) + 1, 1);
+    }
+
+    for (i = 0; i < g->size; ++i) {
+        nt = g->non_terminals + i;
+
+        ((struct gges_bnf_non_terminal *)(image + nts))[i].label = image_offset(labels[i]);
+        ((struct gges_bnf_non_terminal *)(image + nts))[i].modified = false;
+
+        if (nt->size == 0) {
+            ((struct gges_bnf_non_terminal *)(image + nts))[i].productions = NULL;
+            continue;
+        }
+
+        prods = image_append(&image, &size, &capacity, nt->productions,
+                             nt->size * sizeof(struct gges_bnf_production), GGES_IMAGE_ALIGN);
+        ((struct gges_bnf_non_terminal *)(image + nts))[i].productions = image_offset(prods);
+
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            ((struct gges_bnf_production *)(image + prods))[j].nt =
+                image_offset(nts + i * sizeof(struct gges_bnf_non_terminal));
+            if (p->size == 0) {
+                ((struct gges_bnf_production *)(image + prods))[j].tokens = NULL;
+                continue;
+            }
+
+            toks = image_append(&image, &size, &capacity, p->tokens,
+                                p->size * sizeof(struct gges_bnf_token), GGES_IMAGE_ALIGN);
+            ((struct gges_bnf_production *)(image + prods))[j].tokens = image_offset(toks);
+
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (t->nt == NULL) {
+                    off = image_append(&image, &size, &capacity, t->symbol, strlen(t->symbol) + 1, 1);
+                    ((struct gges_bnf_token *)(image + toks))[k].symbol = image_offset(off);
+                    ((struct gges_bnf_token *)(image + toks))[k].nt = NULL;
+                } else {
+                    ((struct gges_bnf_token *)(image + toks))[k].symbol = image_offset(labels[t->nt->id]);
+                    ((struct gges_bnf_token *)(image + toks))[k].nt =
+                        image_offset(nts + t->nt->id * sizeof(struct gges_bnf_non_terminal));
+                }
+            }
+        }
+    }
+    free(labels);
+
+    h.non_terminals = nts;
+    h.n_non_terminals = g->size;
+    h.start = (g->start == NULL) ? -1 : g->start->id;
+
+    h.index_size = g->nt_index.size;
+    h.index_count = g->nt_index.count;
+    if (g->nt_index.size > 0) {
+        h.slots = image_append(&image, &size, &capacity, g->nt_index.slots,
+                               g->nt_index.size * sizeof(int), GGES_IMAGE_ALIGN);
+    }
+
+    if (g->sge_gene_sizes != NULL) {
+        h.gene_sizes = image_append(&image, &size, &capacity, g->sge_gene_sizes,
+                                    g->size * sizeof(int), GGES_IMAGE_ALIGN);
+        h.genome_size = g->sge_genome_size;
+    }
+
+    h.size = size;
+    memcpy(image, &h, sizeof(h));
+
+    /* write to a private file, then move it into place, so that
+     * concurrent runs never see a partially written grammar */
+    tmp_name = ALLOC(strlen(file_name) + 32, sizeof(char), false);
+    sprintf(tmp_name, "%s.%ld", file_name, (long)getpid());
+
+    ok = false;
+    f = fopen(tmp_name, "wb");
+    if (f != NULL) {
+        ok = (fwrite(image, 1, size, f) == size);
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && (rename(tmp_name, file_name) == 0);
+        if (!ok) remove(tmp_name);
+    }
+
+    free(tmp_name);
+    free(image);
+
+    return ok;
+}
+
+
+
+struct gges_bnf_grammar *gges_load_compiled_grammar(const char *file_name,
+                                                    uint64_t source_hash)
+{
+    int fd, i, j, k;
+    char *base;
+    size_t size, got;
+    ssize_t n;
+    bool ok;
+    struct stat st;
+    struct gges_compiled_header *h;
+    struct gges_bnf_grammar *g;
+    struct gges_bnf_non_terminal *nts, *nt;
+    struct gges_bnf_production *p;
+    struct gges_bnf_token *t;
+
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(struct gges_compiled_header))) {
+        close(fd);
+        return NULL;
+    }
+
+    /* the image is read into a single block, and its offsets are
+     * turned into pointers within that block (a private mapping would
+     * copy every page on relocation anyway) */
+    size = st.st_size;
+    base = ALLOC(size, sizeof(char), false);
+    for (got = 0; got < size; got += n) {
+        n = read(fd, base + got, size - got);
+        if (n <= 0) break;
+    }
+    close(fd);
+
+    h = (struct gges_compiled_header *)base;
+    if ((got != size) ||
+        (memcmp(h->magic, GGES_COMPILED_MAGIC, sizeof(h->magic)) != 0) ||
+        (h->layout[0] != sizeof(void *)) ||
+        (h->layout[1] != sizeof(struct gges_bnf_non_terminal)) ||
+        (h->layout[2] != sizeof(struct gges_bnf_production)) ||
+        (h->layout[3] != sizeof(struct gges_bnf_token)) ||
+        (h->source_hash != source_hash) ||
+        (h->size != size) ||
+        !valid_image(base, size)) {
+        free(base);
+        return NULL;
+    }
+
+    nts = (struct gges_bnf_non_terminal *)(base + h->non_terminals);
+    for (i = 0; i < h->n_non_terminals; ++i) {
+        nt = nts + i;
+        nt->label = relocate(base, nt->label);
+        nt->productions = relocate(base, nt->productions);
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            p->nt = relocate(base, p->nt);
+            p->tokens = relocate(base, p->tokens);
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                t->symbol = relocate(base, t->symbol);
+                t->nt = relocate(base, t->nt);
+            }
+        }
+    }
+
+    for (i = 0; i < h->n_non_terminals; ++i) {
+        nt = nts + i;
+        ok = valid_string(base, size, nt->label);
+        for (j = 0; ok && (j < nt->size); ++j) {
+            p = nt->productions + j;
+            for (k = 0; ok && (k < p->size); ++k) ok = valid_string(base, size, p->tokens[k].symbol);
+        }
+        if (!ok) {
+            free(base);
+            return NULL;
+        }
+    }
+
+    g = gges_create_empty_grammar();
+    g->size = h->n_non_terminals;
+    g->non_terminals = nts;
+    g->start = (h->start < 0) ? NULL : nts + h->start;
+    g->linked = g->size;
+
+    g->nt_index.slots = (h->slots == 0) ? NULL : (int *)(base + h->slots);
+    g->nt_index.size = h->index_size;
+    g->nt_index.count = h->index_count;
+
+    if (h->gene_sizes != 0) {
+        g->sge_gene_sizes = ALLOC(g->size, sizeof(int), false);
+        memcpy(g->sge_gene_sizes, base + h->gene_sizes, g->size * sizeof(int));
+        g->sge_genome_size = h->genome_size;
+    }
+
+    g->image = base;
+    g->image_size = size;
+
+    return g;
+}
+
+
+
+uint64_t gges_bnf_source_hash(const char *bnfstr)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*bnfstr) {
+        h ^= (unsigned char)*bnfstr++;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+
+
 struct gges_bnf_grammar *gges_parse_bnf(const char *bnfstr)
 {
     struct gges_bnf_grammar *g;
@@ -129,6 +522,8 @@ void gges_extend_grammar(struct gges_bnf_grammar *g,
     struct gges_bnf_non_terminal *nt;
     struct gges_bnf_production *p;
 
+    begin_modification(g);
+
     nt = NULL;
     p = NULL;
     cur = NULL;
@@ -145,12 +540,231 @@ void gges_extend_grammar(struct gges_bnf_grammar *g,
 
     free(cur);
 
-    if (relink) {
-        link_non_terminal_tokens(g);
-        calculate_production_depths(g);
-        calculate_production_recursion(g);
-        calculate_non_terminal_depths(g);
+    if (relink) gges_relink_grammar(g);
+}
+
+
+
+void gges_add_production(struct gges_bnf_grammar *g,
+                         const char *lhs, const char *rhs)
+{
+    char *token;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+
+    begin_modification(g);
+
+    nt = lookup_non_terminal(g, lhs);
+    if (nt == NULL) nt = create_non_terminal(g, lhs);
+    p = create_production(nt);
+
+    while ((rhs = read_token(rhs, &token)) != NULL) {
+        if (strncmp("|", token, 1) == 0) {
+            p = create_production(nt);
+        } else {
+            append_token(p, token);
+        }
+        free(token);
+    }
+}
+
+
+void gges_add_production_tokens(struct gges_bnf_grammar *g,
+                                const char *lhs,
+                                const struct gges_bnf_token *tokens,
+                                int n)
+{
+    int i;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+
+    begin_modification(g);
+
+    nt = lookup_non_terminal(g, lhs);
+    if (nt == NULL) nt = create_non_terminal(g, lhs);
+    p = create_production(nt);
+
+    for (i = 0; i < n; ++i) append_copied_token(p, tokens + i, tokens[i].symbol);
+}
+
+void gges_add_numbered_terminals(struct gges_bnf_grammar *g,
+                                 const char *lhs, const char *prefix,
+                                 int first, int last)
+{
+    int i;
+    char *symbol;
+    struct gges_bnf_token t;
+
+    symbol = ALLOC(strlen(prefix) + 16, sizeof(char), false);
+
+    t.terminal = true;
+    t.data_field = false;
+    t.symbol = symbol;
+    t.nt = NULL;
+    for (i = first; i <= last; ++i) {
+        sprintf(symbol, "%s%d", prefix, i);
+        gges_add_production_tokens(g, lhs, &t, 1);
+    }
+
+    free(symbol);
+}
+
+
+
+void gges_relink_grammar(struct gges_bnf_grammar *g)
+{
+    int i;
+    bool *affected;
+
+    /* if new non-terminals were created, then the non-terminal array
+     * may have moved, and every token needs to be hooked up again.
+     * Otherwise, only the modified non-terminals need attention */
+    link_non_terminal_tokens(g, g->linked != g->size);
+
+    affected = find_affected_non_terminals(g);
+    calculate_production_depths(g, affected);
+    calculate_production_recursion(g, affected);
+    calculate_non_terminal_depths(g, affected);
+    free(affected);
+
+    for (i = 0; i < g->size; ++i) g->non_terminals[i].modified = false;
+    g->linked = g->size;
+}
+
+
+
+struct gges_bnf_grammar *gges_unroll_grammar(struct gges_bnf_grammar *g,
+                                             int depth)
+{
+    int i, j, k, a, b, n, levels, node, child, head, tail;
+    int *component, *order, *new_id, *queue;
+    bool *all, *cyclic, *live;
+    char *label;
+    struct gges_bnf_grammar *u;
+    struct gges_bnf_non_terminal *nt, *start;
+    struct gges_bnf_production *p, *q;
+    struct gges_bnf_token *t;
+    struct gges_bnf_data_field_gen *gen;
+
+    if (g->size == 0) return gges_create_empty_grammar();
+    start = (g->start == NULL) ? g->non_terminals : g->start;
+    if (depth < 0) depth = 0;
+    levels = depth + 1;
+
+    /* find the cycles in the grammar, each non-terminal on a cycle
+     * gets a copy for each level of recursion, while all others are
+     * used as they are */
+    all = ALLOC(g->size, sizeof(bool), false);
+    for (i = 0; i < g->size; ++i) all[i] = true;
+    component = ALLOC(g->size, sizeof(int), false);
+    order = ALLOC(g->size, sizeof(int), false);
+    n = find_components(g, all, component, order);
+
+    cyclic = ALLOC(g->size, sizeof(bool), true);
+    for (a = 0; a < n; a = b) {
+        for (b = a + 1; (b < n) && (component[order[b]] == component[order[a]]); ++b);
+
+        nt = g->non_terminals + order[a];
+        if ((b - a > 1) || uses_non_terminal(nt, nt)) {
+            for (i = a; i < b; ++i) cyclic[order[i]] = true;
+        }
+    }
+
+    /* level l of non-terminal i is node i * levels + l. A production
+     * is kept if every non-terminal it uses has a live node at the
+     * required level, and a node is live while it keeps at least one
+     * production */
+    live = find_unrolled_live_nodes(g, component, cyclic, levels);
+
+    if (!live[start->id * levels]) {
+        fprintf(stderr, "%s:%d - WARNING: The grammar cannot produce any "
+                "derivation within %d levels of recursion\n",
+                __FILE__, __LINE__, depth);
+        free(live);
+        free(cyclic);
+        free(order);
+        free(component);
+        free(all);
+        return NULL;
+    }
+
+    /* build the unrolled grammar from the start symbol (so that it is
+     * the first non-terminal), adding each node as it is first used */
+    u = gges_create_empty_grammar();
+    new_id = ALLOC(g->size * levels, sizeof(int), false);
+    for (node = 0; node < g->size * levels; ++node) new_id[node] = -1;
+    queue = ALLOC(g->size * levels, sizeof(int), false);
+
+    head = tail = 0;
+    node = start->id * levels;
+    new_id[node] = u->size;
+    create_non_terminal(u, start->label);
+    queue[tail++] = node;
+
+    while ((u != NULL) && (head < tail)) {
+        node = queue[head++];
+        nt = g->non_terminals + node / levels;
+
+        for (j = 0; (u != NULL) && (j < nt->size); ++j) {
+            p = nt->productions + j;
+            if (!keep_unrolled_production(p, component, levels, node, live)) continue;
+
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (t->terminal) continue;
+
+                child = unrolled_node(component, levels, node, t->nt);
+                if (new_id[child] >= 0) continue;
+
+                label = unrolled_label(t->nt->label, child % levels);
+                if (lookup_non_terminal(u, label) != NULL) {
+                    fprintf(stderr, "%s:%d - WARNING: Unrolled non-terminal %s "
+                            "clashes with an existing non-terminal\n",
+                            __FILE__, __LINE__, label);
+                    free(label);
+                    gges_release_grammar(u);
+                    u = NULL;
+                    break;
+                }
+                new_id[child] = u->size;
+                create_non_terminal(u, label);
+                queue[tail++] = child;
+                free(label);
+            }
+            if (u == NULL) break;
+
+            q = create_production(u->non_terminals + new_id[node]);
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (t->terminal) {
+                    append_copied_token(q, t, t->symbol);
+                } else {
+                    child = unrolled_node(component, levels, node, t->nt);
+                    append_copied_token(q, t, u->non_terminals[new_id[child]].label);
+                }
+            }
+        }
+    }
+
+    free(queue);
+    free(new_id);
+    free(live);
+    free(cyclic);
+    free(order);
+    free(component);
+    free(all);
+
+    if (u == NULL) return NULL;
+
+    for (i = 0; i < g->data_field_gen_n; ++i) {
+        gen = register_generator(u, g->data_field_gens[i].key,
+                                 g->data_field_gens[i].type);
+        gen->fn = g->data_field_gens[i].fn;
     }
+
+    gges_relink_grammar(u);
+
+    return u;
 }
 
 
@@ -164,25 +778,33 @@ void gges_release_grammar(struct gges_bnf_grammar *g)
 
     if (g == NULL) return;
 
-    for (i = 0; i < g->size; ++i) {
-        nt = g->non_terminals + i;
-        for (j = 0; j < nt->size; ++j) {
-            p = nt->productions + j;
-            for (k = 0; k < p->size; ++k) {
-                t = p->tokens + k;
-                free(t->symbol);
+    release_size_counts(g);
+    free(g->sge_gene_sizes);
+
+    if ((g->image == NULL) || g->detached) {
+        for (i = 0; i < g->size; ++i) {
+            nt = g->non_terminals + i;
+            for (j = 0; j < nt->size; ++j) {
+                p = nt->productions + j;
+                for (k = 0; k < p->size; ++k) {
+                    t = p->tokens + k;
+                    free(t->symbol);
+                }
+                free(p->tokens);
             }
-            free(p->tokens);
+            free(nt->productions);
+            free(nt->label);
         }
-        free(nt->productions);
-        free(nt->label);
+
+        free(g->non_terminals);
+        free(g->nt_index.slots);
     }
 
-    free(g->non_terminals);
+    for (i = 0; i < g->data_field_gen_n; ++i) free(g->data_field_gens[i].key);
+    free(g->data_field_gens);
+    free(g->data_field_gen_index.slots);
 
-    for (i = 0; i < g->data_field_gen_n; ++i) free(g->data_field_gen_keys[i]);
-    free(g->data_field_gen_keys);
-    free(g->data_field_gen_fn);
+    free(g->image);
 
     free(g);
 }
@@ -276,20 +898,132 @@ int gges_query_productions(struct gges_bnf_production **res,
     return c;
 }
 
-char *gges_bnf_init_data_field(struct gges_bnf_grammar *g, char *key, double (*rnd)(void))
+double gges_bnf_count_derivations(struct gges_bnf_grammar *g,
+                                  struct gges_bnf_non_terminal *nt,
+                                  int size)
 {
-    int i;
-    for (i = 0; i < g->data_field_gen_n; ++i) {
-        if (strcmp(key, g->data_field_gen_keys[i]) == 0) return g->data_field_gen_fn[i](rnd);
+    if (size < 1) return 0;
+
+    if (g->size_counts == NULL || g->size_counts->max_size < size) {
+        build_size_counts(g, size);
     }
 
-    fprintf(stderr, "%s:%d - WARNING: Could not find data field generator with key %s, returning null\n",
-            __FILE__, __LINE__, key);
-    return NULL;
+    return exp(g->size_counts->nt[nt->id][size]);
 }
 
 
 
+int gges_bnf_sample_derivation(struct gges_bnf_grammar *g,
+                               struct gges_bnf_non_terminal *nt,
+                               int min_size, int max_size,
+                               struct gges_bnf_production **seq,
+                               double (*rnd)(void))
+{
+    int n, size, pos;
+
+    if (min_size < 1) min_size = 1;
+    if (max_size < min_size) return 0;
+
+    if (g->size_counts == NULL || g->size_counts->max_size < max_size) {
+        build_size_counts(g, max_size);
+    }
+
+    /* count the sizes that can be produced, and pick one of them */
+    size = 0;
+    for (n = min_size; n <= max_size; ++n) {
+        if (g->size_counts->nt[nt->id][n] > -INFINITY) size++;
+    }
+    if (size == 0) return 0;
+
+    size = (int)(rnd() * size);
+    for (n = min_size; n <= max_size; ++n) {
+        if (g->size_counts->nt[nt->id][n] > -INFINITY && size-- == 0) break;
+    }
+
+    pos = 0;
+    sample_derivation(g, nt, n, seq, &pos, rnd);
+
+    return pos;
+}
+
+
+
+void gges_bnf_init_data_field(struct gges_bnf_grammar *g, char *key,
+                              struct gges_bnf_data_field *field,
+                              double (*rnd)(void))
+{
+    int i;
+    struct gges_bnf_data_field_gen *gen;
+
+    i = find_symbol(g, &(g->data_field_gen_index), data_field_gen_key, key);
+    if (i >= 0) {
+        gen = g->data_field_gens + i;
+
+        field->type = gen->type;
+        switch (gen->type) {
+        case GGES_DATA_FIELD_DOUBLE: field->value.d = gen->fn.d(rnd); break;
+        case GGES_DATA_FIELD_INT:    field->value.i = gen->fn.i(rnd); break;
+        default:                     field->value.s = gen->fn.s(rnd); break;
+        }
+        return;
+    }
+
+    fprintf(stderr, "%s:%d - WARNING: Could not find data field generator with key %s, returning null\n",
+            __FILE__, __LINE__, key);
+    field->type = GGES_DATA_FIELD_STRING;
+    field->value.s = NULL;
+}
+
+
+
+void gges_bnf_copy_data_field(struct gges_bnf_data_field *dest,
+                              struct gges_bnf_data_field *src)
+{
+    *dest = *src;
+
+    if (src->type == GGES_DATA_FIELD_STRING && src->value.s != NULL) {
+        dest->value.s = ALLOC((strlen(src->value.s) + 1), sizeof(char), false);
+        if (dest->value.s == NULL) {
+            fprintf(stderr, "%s:%d - ERROR: Failed to allocate memory\n",
+                    __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(dest->value.s, src->value.s);
+    }
+}
+
+
+
+void gges_bnf_release_data_field(struct gges_bnf_data_field *field)
+{
+    if (field->type == GGES_DATA_FIELD_STRING) free(field->value.s);
+    field->value.s = NULL;
+}
+
+
+
+const char *gges_bnf_data_field_text(struct gges_bnf_data_field *field, char *buffer)
+{
+    switch (field->type) {
+    case GGES_DATA_FIELD_DOUBLE:
+        /* prefer the (more readable) shorter form, unless it loses
+         * precision */
+        snprintf(buffer, GGES_DATA_FIELD_TEXT_LEN, "%.15g", field->value.d);
+        if (strtod(buffer, NULL) != field->value.d) {
+            snprintf(buffer, GGES_DATA_FIELD_TEXT_LEN, "%.17g", field->value.d);
+        }
+        return buffer;
+
+    case GGES_DATA_FIELD_INT:
+        snprintf(buffer, GGES_DATA_FIELD_TEXT_LEN, "%d", field->value.i);
+        return buffer;
+
+    default:
+        return (field->value.s == NULL) ? "" : field->value.s;
+    }
+}
+
+
 
 
 
@@ -331,6 +1065,273 @@ static long file_length(const char *file_name)
     return flen;
 }
 
+static char *read_file(const char *file_name)
+{
+    FILE *f;
+    char *data;
+    long flen, read;
+
+    flen = file_length(file_name);
+
+    f = fopen(file_name, "r");
+    if (f == NULL) {
+        fprintf(stderr, "%s:%d - ERROR: Failed to open file %s\n",
+                __FILE__, __LINE__, file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    data = ALLOC(flen + 1, sizeof(char), false);
+    read = fread(data, 1, flen, f);
+    data[read] = '\0';
+    fclose(f);
+
+    return data;
+}
+
+
+
+/* readies the grammar for new productions. A mapped grammar is first
+ * copied out of its image (so that its arrays can grow), and anything
+ * derived from the current productions is discarded */
+static void begin_modification(struct gges_bnf_grammar *g)
+{
+    detach_image(g);
+    release_size_counts(g);
+
+    free(g->sge_gene_sizes);
+    g->sge_gene_sizes = NULL;
+    g->sge_genome_size = 0;
+}
+
+static char *copy_string(const char *s)
+{
+    char *c;
+
+    c = ALLOC(strlen(s) + 1, sizeof(char), false);
+    strcpy(c, s);
+
+    return c;
+}
+
+static void detach_image(struct gges_bnf_grammar *g)
+{
+    int i, j, k;
+    int *slots;
+    struct gges_bnf_non_terminal *nts, *nt;
+    struct gges_bnf_production *prods;
+    struct gges_bnf_token *toks;
+
+    if ((g->image == NULL) || g->detached) return;
+
+    nts = ALLOC(g->size, sizeof(struct gges_bnf_non_terminal), false);
+    memcpy(nts, g->non_terminals, g->size * sizeof(struct gges_bnf_non_terminal));
+
+    for (i = 0; i < g->size; ++i) {
+        nt = nts + i;
+        nt->label = copy_string(nt->label);
+
+        prods = ALLOC(nt->size, sizeof(struct gges_bnf_production), false);
+        memcpy(prods, nt->productions, nt->size * sizeof(struct gges_bnf_production));
+        nt->productions = prods;
+
+        for (j = 0; j < nt->size; ++j) {
+            prods[j].nt = nt;
+
+            toks = ALLOC(prods[j].size, sizeof(struct gges_bnf_token), false);
+            memcpy(toks, prods[j].tokens, prods[j].size * sizeof(struct gges_bnf_token));
+            prods[j].tokens = toks;
+
+            for (k = 0; k < prods[j].size; ++k) {
+                toks[k].symbol = copy_string(toks[k].symbol);
+                if (toks[k].nt != NULL) toks[k].nt = nts + toks[k].nt->id;
+            }
+        }
+    }
+
+    slots = ALLOC(g->nt_index.size, sizeof(int), false);
+    memcpy(slots, g->nt_index.slots, g->nt_index.size * sizeof(int));
+    g->nt_index.slots = slots;
+
+    if (g->start != NULL) g->start = nts + g->start->id;
+    g->non_terminals = nts;
+
+    /* the image is kept until the grammar is released, as the caller
+     * may still hold strings from it (e.g., a non-terminal label) */
+    g->detached = true;
+}
+
+/* copies n bytes onto the end of the image, at an offset that is a
+ * multiple of align (a power of two), and returns that offset */
+static size_t image_append(char **image, size_t *size, size_t *capacity,
+                           const void *data, size_t n, size_t align)
+{
+    size_t offset;
+
+    offset = (*size + align - 1) & ~(align - 1);
+    if (offset + n > *capacity) {
+        while (offset + n > *capacity) *capacity = (*capacity == 0) ? 4096 : *capacity * 2;
+        *image = REALLOC(*image, *capacity, sizeof(char));
+    }
+
+    memset(*image + *size, 0, offset - *size);
+    if (n > 0) memcpy(*image + offset, data, n);
+    *size = offset + n;
+
+    return offset;
+}
+
+static void *image_offset(size_t offset)
+{
+    return (void *)(uintptr_t)offset;
+}
+
+/* converts an offset stored in a pointer field of a compiled grammar
+ * back into a pointer into the loaded image (zero is NULL) */
+static void *relocate(char *base, void *offset)
+{
+    return (offset == NULL) ? NULL : base + (uintptr_t)offset;
+}
+
+/* checks that n bytes at the given offset lie within an image of the
+ * given size, at the given alignment, and after the end of the
+ * previously checked range (which is then moved past these bytes).
+ * The arrays are relocated in place, so they must not overlap */
+static bool valid_range(size_t size, size_t *end, uint64_t offset, size_t n, size_t align)
+{
+    if ((offset < *end) || (offset > size) || (n > size - offset) || ((offset % align) != 0)) {
+        return false;
+    }
+
+    *end = offset + n;
+    return true;
+}
+
+/* checks that a string offset lies within the image (its end is
+ * checked once it has been relocated) */
+static bool valid_offset(size_t size, void *offset)
+{
+    return ((uintptr_t)offset >= sizeof(struct gges_compiled_header)) &&
+        ((uintptr_t)offset < size);
+}
+
+/* checks that a flag read from an image holds a valid bool */
+static bool valid_flag(const bool *flag)
+{
+    return *(const unsigned char *)flag <= 1;
+}
+
+/* checks that a (relocated) string starts and ends within the image.
+ * This is done after relocation, as a string in a damaged image could
+ * share bytes with a pointer that relocation rewrites */
+static bool valid_string(const char *base, size_t size, const char *s)
+{
+    return (s >= base + sizeof(struct gges_compiled_header)) && (s < base + size) &&
+        (memchr(s, '\0', base + size - s) != NULL);
+}
+
+/* checks every count and array offset of a compiled grammar image
+ * (before any of them are relocated), so that a damaged or truncated
+ * file is rejected rather than followed out of bounds */
+static bool valid_image(const char *base, size_t size)
+{
+    int i, j, k, used;
+    size_t end, off;
+    const int *slots;
+    struct gges_compiled_header *h;
+    struct gges_bnf_non_terminal *nts, *nt;
+    struct gges_bnf_production *prods, *p;
+    struct gges_bnf_token *toks, *t;
+
+    h = (struct gges_compiled_header *)base;
+    end = sizeof(struct gges_compiled_header);
+    if ((h->n_non_terminals < 0) ||
+        (h->start < -1) || (h->start >= h->n_non_terminals) ||
+        !valid_range(size, &end, h->non_terminals,
+                     h->n_non_terminals * sizeof(struct gges_bnf_non_terminal),
+                     GGES_IMAGE_ALIGN)) {
+        return false;
+    }
+
+    nts = (struct gges_bnf_non_terminal *)(base + h->non_terminals);
+    for (i = 0; i < h->n_non_terminals; ++i) {
+        nt = nts + i;
+        if ((nt->id != i) || (nt->size < 0) || (nt->min_depth < 0) ||
+            !valid_flag(&nt->recursive) || !valid_flag(&nt->modified) ||
+            !valid_offset(size, nt->label)) {
+            return false;
+        }
+        if (nt->size == 0) continue;
+        if (!valid_range(size, &end, (uintptr_t)nt->productions,
+                         nt->size * sizeof(struct gges_bnf_production), GGES_IMAGE_ALIGN)) {
+            return false;
+        }
+
+        prods = (struct gges_bnf_production *)(base + (uintptr_t)nt->productions);
+        for (j = 0; j < nt->size; ++j) {
+            p = prods + j;
+            if ((p->id != j) || (p->size < 0) || (p->min_depth < 0) ||
+                !valid_flag(&p->recursive) ||
+                ((uintptr_t)p->nt != h->non_terminals + i * sizeof(struct gges_bnf_non_terminal))) {
+                return false;
+            }
+            if (p->size == 0) continue;
+            if (!valid_range(size, &end, (uintptr_t)p->tokens,
+                             p->size * sizeof(struct gges_bnf_token), GGES_IMAGE_ALIGN)) {
+                return false;
+            }
+
+            /* the non-terminal of a token (if it is not a terminal)
+             * must be exactly one of the image's non-terminals */
+            toks = (struct gges_bnf_token *)(base + (uintptr_t)p->tokens);
+            for (k = 0; k < p->size; ++k) {
+                t = toks + k;
+                if (!valid_flag(&t->terminal) || !valid_flag(&t->data_field) ||
+                    !valid_offset(size, t->symbol) ||
+                    (*(const unsigned char *)&t->terminal != (t->nt == NULL))) {
+                    return false;
+                }
+                if (t->nt == NULL) continue;
+
+                off = (uintptr_t)t->nt;
+                if ((off < h->non_terminals) ||
+                    (((off - h->non_terminals) % sizeof(struct gges_bnf_non_terminal)) != 0) ||
+                    ((off - h->non_terminals) / sizeof(struct gges_bnf_non_terminal) >=
+                     (size_t)h->n_non_terminals)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    /* the index is open-addressed with a power of two size, so it
+     * must have at least one empty slot for lookups to terminate */
+    if ((h->index_size < 0) || ((h->index_size & (h->index_size - 1)) != 0) ||
+        ((h->slots == 0) != (h->index_size == 0))) {
+        return false;
+    }
+    if (h->index_size > 0) {
+        if (!valid_range(size, &end, h->slots, h->index_size * sizeof(int), GGES_IMAGE_ALIGN)) {
+            return false;
+        }
+
+        slots = (const int *)(base + h->slots);
+        for (i = used = 0; i < h->index_size; ++i) {
+            if (slots[i] >= h->n_non_terminals) return false;
+            if (slots[i] >= 0) ++used;
+        }
+        if ((used != h->index_count) || (used == h->index_size)) return false;
+    }
+
+    if ((h->gene_sizes != 0) &&
+        ((h->genome_size < 0) ||
+         !valid_range(size, &end, h->gene_sizes, h->n_non_terminals * sizeof(int),
+                      GGES_IMAGE_ALIGN))) {
+        return false;
+    }
+
+    return true;
+}
+
 
 
 static void write_token(FILE *f, const char *s)
@@ -517,6 +1518,185 @@ static void append_token(struct gges_bnf_production *p, const char *token)
     t->symbol[l] = '\0';
 }
 
+static void append_copied_token(struct gges_bnf_production *p,
+                                const struct gges_bnf_token *t,
+                                const char *symbol)
+{
+    struct gges_bnf_token *c;
+
+    p->tokens = REALLOC(p->tokens, (p->size + 1), sizeof(struct gges_bnf_token));
+    c = p->tokens + p->size++;
+
+    c->terminal = t->terminal;
+    c->data_field = t->data_field;
+    c->symbol = copy_string(symbol);
+    c->nt = NULL;
+}
+
+/* the label of a non-terminal at the given level of recursion when
+ * unrolling a grammar, where <expr> becomes <expr_0>, <expr_1>, and so
+ * on (level 0 keeps the original label) */
+static char *unrolled_label(const char *label, int level)
+{
+    char *l;
+    size_t n;
+
+    n = strlen(label);
+    l = ALLOC(n + 16, sizeof(char), false);
+    if (level == 0) {
+        strcpy(l, label);
+    } else if ((n > 0) && (label[n - 1] == '>')) {
+        sprintf(l, "%.*s_%d>", (int)(n - 1), label, level - 1);
+    } else {
+        sprintf(l, "%s_%d", label, level - 1);
+    }
+
+    return l;
+}
+
+/* the node used by the given node when it expands to child. Using a
+ * non-terminal from the same cycle moves down a level, anything else
+ * starts from the top level of that non-terminal. Returns -1 if the
+ * node is on the last level, and cannot recurse any further */
+static int unrolled_node(int *component, int levels, int node,
+                         struct gges_bnf_non_terminal *child)
+{
+    if (component[child->id] != component[node / levels]) return child->id * levels;
+    if (node % levels == levels - 1) return -1;
+    return child->id * levels + node % levels + 1;
+}
+
+static bool keep_unrolled_production(struct gges_bnf_production *p,
+                                     int *component, int levels,
+                                     int node, bool *live)
+{
+    int k, child;
+
+    for (k = 0; k < p->size; ++k) {
+        if (p->tokens[k].terminal) continue;
+
+        child = unrolled_node(component, levels, node, p->tokens[k].nt);
+        if ((child < 0) || !live[child]) return false;
+    }
+
+    return true;
+}
+
+/* finds the live nodes of the unrolled grammar, working back from the
+ * nodes that have no productions left to keep rather than sweeping
+ * over every node until nothing changes */
+static bool *find_unrolled_live_nodes(struct gges_bnf_grammar *g,
+                                      int *component, bool *cyclic,
+                                      int levels)
+{
+    int i, j, k, n, node, child, head, tail;
+    int *base, *owner, *count, *first, *users, *queue;
+    bool *live, *dropped;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+    struct gges_bnf_token *t;
+
+    n = g->size * levels;
+
+    /* every level of a cyclic non-terminal, and the top level of any
+     * other, starts out live. Each of their productions gets a flat
+     * index, productions base[node] up to base[node + 1] belonging to
+     * the node */
+    live = ALLOC(n, sizeof(bool), true);
+    base = ALLOC(n + 1, sizeof(int), true);
+    for (node = 0; node < n; ++node) {
+        nt = g->non_terminals + node / levels;
+        live[node] = cyclic[nt->id] || (node % levels == 0);
+        base[node + 1] = base[node] + (live[node] ? nt->size : 0);
+    }
+
+    /* count the productions that each node can keep (those that do
+     * not recurse past the last level), and build the reverse
+     * reference graph, users[first[c]] up to users[first[c + 1]]
+     * lists the kept productions that expand to node c */
+    owner = ALLOC(base[n] + 1, sizeof(int), false);
+    dropped = ALLOC(base[n] + 1, sizeof(bool), true);
+    count = ALLOC(n, sizeof(int), true);
+    first = ALLOC(n + 1, sizeof(int), true);
+    for (node = 0; node < n; ++node) {
+        if (!live[node]) continue;
+
+        nt = g->non_terminals + node / levels;
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            owner[base[node] + j] = node;
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (!t->terminal && (unrolled_node(component, levels, node, t->nt) < 0)) break;
+            }
+            if (k < p->size) {
+                dropped[base[node] + j] = true;
+                continue;
+            }
+            count[node]++;
+
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (!t->terminal) first[unrolled_node(component, levels, node, t->nt) + 1]++;
+            }
+        }
+    }
+    for (i = 0; i < n; ++i) first[i + 1] += first[i];
+
+    users = ALLOC(first[n] + 1, sizeof(int), false);
+    for (i = 0; i < base[n]; ++i) {
+        if (dropped[i]) continue;
+
+        node = owner[i];
+        p = g->non_terminals[node / levels].productions + (i - base[node]);
+        for (k = 0; k < p->size; ++k) {
+            t = p->tokens + k;
+            if (!t->terminal) users[first[unrolled_node(component, levels, node, t->nt)]++] = i;
+        }
+    }
+    /* the fill above shifted each start to the next entry's start */
+    for (i = n; i > 0; --i) first[i] = first[i - 1];
+    first[0] = 0;
+
+    /* a node without any productions left is dead, which drops every
+     * production that expands to it, and possibly kills their owners
+     * in turn (so the deepest levels, which cannot recurse any
+     * further, may end up removing productions from those above) */
+    queue = ALLOC(n + 1, sizeof(int), false);
+    head = tail = 0;
+    for (node = 0; node < n; ++node) {
+        if (live[node] && (count[node] == 0)) {
+            live[node] = false;
+            queue[tail++] = node;
+        }
+    }
+
+    while (head < tail) {
+        child = queue[head++];
+        for (j = first[child]; j < first[child + 1]; ++j) {
+            i = users[j];
+            if (dropped[i]) continue;
+            dropped[i] = true;
+
+            node = owner[i];
+            if (--count[node] == 0) {
+                live[node] = false;
+                queue[tail++] = node;
+            }
+        }
+    }
+
+    free(queue);
+    free(users);
+    free(first);
+    free(count);
+    free(dropped);
+    free(owner);
+    free(base);
+
+    return live;
+}
+
 static struct gges_bnf_non_terminal *lookup_non_terminal(
     struct gges_bnf_grammar *g, const char *label)
 {
@@ -524,15 +1704,284 @@ static struct gges_bnf_non_terminal *lookup_non_terminal(
 
     if (label == NULL) return NULL;
 
+    i = find_symbol(g, &(g->nt_index), non_terminal_label, label);
+
+    return (i < 0) ? NULL : (g->non_terminals + i);
+}
+
+
+
+static const char *non_terminal_label(struct gges_bnf_grammar *g, int i)
+{
+    return g->non_terminals[i].label;
+}
+
+
+
+static const char *data_field_gen_key(struct gges_bnf_grammar *g, int i)
+{
+    return g->data_field_gens[i].key;
+}
+
+
+
+/* FNV-1a hash of a string */
+static unsigned long hash_symbol(const char *key)
+{
+    unsigned long h = 2166136261UL;
+
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619UL;
+    }
+
+    return h;
+}
+
+
+
+/* returns the position of the element with the given name, or -1 if
+ * there is no such element. As the index only holds positions, the
+ * names are read back from the underlying array via the name
+ * function */
+static int find_symbol(struct gges_bnf_grammar *g,
+                       struct gges_bnf_symbol_index *index,
+                       const char *(*name)(struct gges_bnf_grammar *, int),
+                       const char *key)
+{
+    unsigned long i, mask;
+
+    if (index->size == 0) return -1;
+
+    mask = index->size - 1;
+    for (i = hash_symbol(key) & mask; index->slots[i] >= 0; i = (i + 1) & mask) {
+        if (strcmp(key, name(g, index->slots[i])) == 0) return index->slots[i];
+    }
+
+    return -1;
+}
+
+
+
+/* adds the element at the given position to the index (the caller
+ * must ensure that its name is not already present), doubling the
+ * size of the index whenever it becomes half full */
+static void insert_symbol(struct gges_bnf_grammar *g,
+                          struct gges_bnf_symbol_index *index,
+                          const char *(*name)(struct gges_bnf_grammar *, int),
+                          int pos)
+{
+    int j, old_size, *old_slots;
+    unsigned long i, mask;
+
+    if (2 * (index->count + 1) > index->size) {
+        old_slots = index->slots;
+        old_size = index->size;
+
+        index->size = (old_size == 0) ? 16 : (2 * old_size);
+        index->slots = ALLOC(index->size, sizeof(int), false);
+        for (j = 0; j < index->size; ++j) index->slots[j] = -1;
+        index->count = 0;
+
+        for (j = 0; j < old_size; ++j) {
+            if (old_slots[j] >= 0) insert_symbol(g, index, name, old_slots[j]);
+        }
+        free(old_slots);
+    }
+
+    mask = index->size - 1;
+    for (i = hash_symbol(name(g, pos)) & mask; index->slots[i] >= 0; i = (i + 1) & mask);
+
+    index->slots[i] = pos;
+    index->count++;
+}
+
+/* fills the derivation count tables for sizes up to max_size, using
+ * the usual recurrence: the derivations of a non-terminal of size n
+ * are those of each of its productions with n - 1 productions shared
+ * among the production's non-terminals, and these are counted by
+ * convolving the counts of the non-terminals from right to left. The
+ * counts are held as logarithms, so that they cannot overflow */
+static void build_size_counts(struct gges_bnf_grammar *g, int max_size)
+{
+    int i, j, k, c, n, s, w;
+    double *t, sum;
+    struct gges_bnf_size_counts *sc;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+
+    release_size_counts(g);
+
+    sc = g->size_counts = ALLOC(1, sizeof(struct gges_bnf_size_counts), false);
+    sc->max_size = max_size;
+    w = max_size + 1;
+
+    sc->nt = ALLOC(g->size, sizeof(double *), false);
+    sc->prod = ALLOC(g->size, sizeof(double **), false);
     for (i = 0; i < g->size; ++i) {
-        if (strcmp(label, g->non_terminals[i].label) == 0) {
-            return (g->non_terminals + i);
+        nt = g->non_terminals + i;
+        sc->nt[i] = ALLOC(w, sizeof(double), false);
+        for (n = 0; n < w; ++n) sc->nt[i][n] = -INFINITY;
+        sc->prod[i] = ALLOC(nt->size, sizeof(double *), false);
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            for (k = c = 0; c < p->size; ++c) if (!p->tokens[c].terminal) k++;
+
+            /* with no non-terminals left, there is exactly one way
+             * (i.e., log(1) = 0) to use zero productions */
+            sc->prod[i][j] = ALLOC((k + 1) * w, sizeof(double), false);
+            for (n = 0; n < (k + 1) * w; ++n) sc->prod[i][j][n] = -INFINITY;
+            sc->prod[i][j][k * w + 0] = 0;
         }
     }
 
-    return NULL;
+    /* the counts for size n only depend on those of smaller sizes, so
+     * the tables are filled one size at a time */
+    for (n = 1; n <= max_size; ++n) {
+        for (i = 0; i < g->size; ++i) {
+            nt = g->non_terminals + i;
+            for (j = 0; j < nt->size; ++j) {
+                p = nt->productions + j;
+                t = sc->prod[i][j];
+
+                /* the suffix starting at the c-th non-terminal, using
+                 * n - 1 productions in total */
+                for (k = c = 0; c < p->size; ++c) if (!p->tokens[c].terminal) k++;
+                for (c = p->size; c--;) {
+                    if (p->tokens[c].terminal) continue;
+                    k--;
+
+                    sum = -INFINITY;
+                    for (s = 1; s < n; ++s) {
+                        sum = log_add(sum, sc->nt[p->tokens[c].nt->id][s] + t[(k + 1) * w + (n - 1 - s)]);
+                    }
+                    t[k * w + (n - 1)] = sum;
+                }
+
+                sc->nt[i][n] = log_add(sc->nt[i][n], t[n - 1]);
+            }
+        }
+    }
+}
+
+
+
+static void release_size_counts(struct gges_bnf_grammar *g)
+{
+    int i, j;
+
+    if (g->size_counts == NULL) return;
+
+    for (i = 0; i < g->size; ++i) {
+        for (j = 0; j < g->non_terminals[i].size; ++j) free(g->size_counts->prod[i][j]);
+        free(g->size_counts->prod[i]);
+        free(g->size_counts->nt[i]);
+    }
+    free(g->size_counts->prod);
+    free(g->size_counts->nt);
+    free(g->size_counts);
+
+    g->size_counts = NULL;
+}
+
+/* returns log(exp(a) + exp(b)), without leaving log-space */
+static double log_add(double a, double b)
+{
+    if (a == -INFINITY) return b;
+    if (b == -INFINITY) return a;
+
+    return (a > b) ? a + log1p(exp(b - a)) : b + log1p(exp(a - b));
+}
+
+
+
+/* draws a derivation of the given size uniformly at random, by
+ * picking each production (and then the size of each non-terminal
+ * within it) in proportion to the number of derivations that follow
+ * from that choice */
+static void sample_derivation(struct gges_bnf_grammar *g,
+                              struct gges_bnf_non_terminal *nt, int size,
+                              struct gges_bnf_production **seq, int *pos,
+                              double (*rnd)(void))
+{
+    int j, k, c, s, w, remaining;
+    double *t, r, total, ways;
+    struct gges_bnf_size_counts *sc;
+    struct gges_bnf_production *p;
+
+    sc = g->size_counts;
+    w = sc->max_size + 1;
+
+    /* pick the production, with the counts taken relative to the
+     * total so that they are back in a usable range */
+    total = sc->nt[nt->id][size];
+    r = rnd();
+    for (j = 0; j < nt->size - 1; ++j) {
+        r -= exp(sc->prod[nt->id][j][size - 1] - total);
+        if (r < 0 && sc->prod[nt->id][j][size - 1] > -INFINITY) break;
+    }
+    while (sc->prod[nt->id][j][size - 1] == -INFINITY) j--; /* guard against rounding */
+
+    p = nt->productions + j;
+    t = sc->prod[nt->id][j];
+    seq[(*pos)++] = p;
+
+    /* then share out the remaining productions among the
+     * non-terminals of the production, from left to right, deriving
+     * each one before moving on to the next */
+    remaining = size - 1;
+    for (k = c = 0; c < p->size; ++c) {
+        if (p->tokens[c].terminal) continue;
+
+        total = t[k * w + remaining];
+        r = rnd();
+        for (s = 1; s < remaining; ++s) {
+            ways = sc->nt[p->tokens[c].nt->id][s] + t[(k + 1) * w + (remaining - s)];
+            r -= exp(ways - total);
+            if (r < 0 && ways > -INFINITY) break;
+        }
+        while (sc->nt[p->tokens[c].nt->id][s] + t[(k + 1) * w + (remaining - s)] == -INFINITY) s--;
+
+        sample_derivation(g, p->tokens[c].nt, s, seq, pos, rnd);
+
+        remaining -= s;
+        k++;
+    }
+}
+
+
+
+/* finds (or creates) the registry entry for the given key, and sets
+ * its type - the caller then fills in the generator itself */
+static struct gges_bnf_data_field_gen *register_generator(
+        struct gges_bnf_grammar *g, const char *key,
+        enum gges_bnf_data_field_type type)
+{
+    int i;
+    struct gges_bnf_data_field_gen *gen;
+
+    i = find_symbol(g, &(g->data_field_gen_index), data_field_gen_key, key);
+    if (i >= 0) {
+        /* field already exists, so overwrite the current generator */
+        g->data_field_gens[i].type = type;
+        return g->data_field_gens + i;
+    }
+
+    i = g->data_field_gen_n++;
+    g->data_field_gens = REALLOC(g->data_field_gens, g->data_field_gen_n, sizeof(struct gges_bnf_data_field_gen));
+
+    gen = g->data_field_gens + i;
+    gen->key = ALLOC((strlen(key) + 1), sizeof(char), false);
+    strcpy(gen->key, key);
+    gen->type = type;
+
+    insert_symbol(g, &(g->data_field_gen_index), data_field_gen_key, i);
+
+    return gen;
 }
 
+
+
 static struct gges_bnf_non_terminal *create_non_terminal(
     struct gges_bnf_grammar *g, const char *label)
 {
@@ -545,10 +1994,13 @@ static struct gges_bnf_non_terminal *create_non_terminal(
     nt->label = ALLOC(strlen(label) + 1, sizeof(char), false);
     strcpy(nt->label, label);
 
+    insert_symbol(g, &(g->nt_index), non_terminal_label, nt->id);
+
     nt->size = 0;
     nt->productions = NULL;
 
     nt->recursive = false;
+    nt->modified = true;
 
     return nt;
 }
@@ -568,6 +2020,8 @@ static struct gges_bnf_production *create_production(
     p->min_depth = 0; /* size calculation needed */
     p->recursive = false;
 
+    nt->modified = true;
+
     return p;
 }
 
@@ -606,175 +2060,354 @@ static void process_token(struct gges_bnf_grammar *g,
 
 
 
+static void calculate_production_depths(struct gges_bnf_grammar *g,
+                                        const bool *affected)
+{
+    int i, j, k, n, q, d, max_depth;
+    int *offset, *pending, *deepest, *next, *bucket, *first, *users;
+    bool *resolved;
 
+    struct gges_bnf_production **prods;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+    struct gges_bnf_token *t;
 
+    /* give each production a flat index, so that the working state
+     * for each can be held in simple arrays */
+    offset = ALLOC(g->size + 1, sizeof(int), false);
+    offset[0] = 0;
+    for (i = 0; i < g->size; ++i) {
+        offset[i + 1] = offset[i] + g->non_terminals[i].size;
+    }
+    n = offset[g->size];
+
+    prods = ALLOC(n + 1, sizeof(struct gges_bnf_production *), false);
+    pending = ALLOC(n + 1, sizeof(int), true);
+    deepest = ALLOC(n + 1, sizeof(int), true);
+    next = ALLOC(n + 1, sizeof(int), false);
+    first = ALLOC(g->size + 1, sizeof(int), true);
+    resolved = ALLOC(g->size + 1, sizeof(bool), true);
+
+    /* count the non-terminal tokens that each affected production is
+     * waiting on, and how often each affected non-terminal is used.
+     * The depths of unaffected non-terminals are still valid, so they
+     * count towards the deepest child of a production straight away.
+     * A shallowest derivation never repeats a non-terminal along a
+     * path, so each affected non-terminal adds at most one level to
+     * the deepest unaffected one */
+    max_depth = 1;
+    d = 0;
+    for (i = 0; i < g->size; ++i) {
+        nt = g->non_terminals + i;
+        if (!affected[i]) {
+            if (nt->min_depth > d) d = nt->min_depth;
+            continue;
+        }
 
+        max_depth++;
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            q = offset[i] + j;
+            prods[q] = p;
+            p->min_depth = 0;
 
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (t->terminal) continue;
 
+                if (affected[t->nt->id]) {
+                    pending[q]++;
+                    first[t->nt->id + 1]++;
+                } else if (t->nt->min_depth <= 0) {
+                    /* a non-terminal without productions, so this
+                     * production can never be completed */
+                    pending[q]++;
+                } else if (t->nt->min_depth > deepest[q]) {
+                    deepest[q] = t->nt->min_depth;
+                }
+            }
+        }
+    }
 
+    max_depth += d;
 
-static int get_non_terminal_depth(struct gges_bnf_non_terminal *nt)
-{
-    int i;
-    int depth;
+    /* build the list of productions that use each affected
+     * non-terminal, users[first[i]] up to users[first[i + 1]] */
+    for (i = 0; i < g->size; ++i) first[i + 1] += first[i];
+    users = ALLOC(first[g->size] + 1, sizeof(int), false);
+    for (i = 0; i < g->size; ++i) {
+        if (!affected[i]) continue;
+        nt = g->non_terminals + i;
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (!t->terminal && affected[t->nt->id]) {
+                    users[first[t->nt->id]++] = offset[i] + j;
+                }
+            }
+        }
+    }
+    for (i = g->size; i > 0; --i) first[i] = first[i - 1];
+    first[0] = 0;
+
+    /* productions are placed into buckets by depth once all of their
+     * non-terminals are resolved. The buckets are emptied in order of
+     * depth, so the first production seen for a non-terminal is one
+     * of its shallowest, which resolves the non-terminal at that
+     * depth and may in turn complete the productions that use it */
+    bucket = ALLOC(max_depth + 2, sizeof(int), false);
+    for (d = 0; d < max_depth + 2; ++d) bucket[d] = -1;
+    for (i = 0; i < g->size; ++i) {
+        if (!affected[i]) continue;
+        for (q = offset[i]; q < offset[i + 1]; ++q) {
+            if (pending[q] > 0) continue;
+            next[q] = bucket[deepest[q] + 1];
+            bucket[deepest[q] + 1] = q;
+        }
+    }
 
-    /* assume the default position that the non-terminal cannot be
-     * labelled with a minimum depth */
-    depth = 0;
+    for (d = 1; d < max_depth + 2; ++d) {
+        while (bucket[d] >= 0) {
+            q = bucket[d];
+            bucket[d] = next[q];
 
-    for (i = 0; i < nt->size; ++i) {
-        /* if we have not analysed this production, then skip */
-        if (nt->productions[i].min_depth == 0) continue;
+            p = prods[q];
+            p->min_depth = d;
 
-        /* if this is the first production that we have inspected,
-         * then assign its minimum depth as the current representative
-         * depth */
-        if (depth == 0) depth = nt->productions[i].min_depth;
+            i = p->nt->id;
+            if (resolved[i]) continue;
+            resolved[i] = true;
 
-        /* if the current production has a minimum depth smaller than
-         * that of the current representative depth, then overwrite
-         * the non-terminal's representative depth */
-        if (nt->productions[i].min_depth < depth) {
-            depth = nt->productions[i].min_depth;
+            for (k = first[i]; k < first[i + 1]; ++k) {
+                q = users[k];
+                if (d > deepest[q]) deepest[q] = d;
+                if (--pending[q] > 0) continue;
+                next[q] = bucket[deepest[q] + 1];
+                bucket[deepest[q] + 1] = q;
+            }
         }
     }
 
-    return depth;
+    free(bucket);
+    free(users);
+    free(resolved);
+    free(first);
+    free(next);
+    free(deepest);
+    free(pending);
+    free(prods);
+    free(offset);
+
+    for (i = 0; i < g->size; ++i) {
+        if (!affected[i]) continue;
+        nt = g->non_terminals + i;
+        for (j = 0; j < nt->size; ++j) {
+            if (nt->productions[j].min_depth > 0) continue;
+
+            fprintf(stderr,
+                    "%s:%d - ERROR: Incomplete grammar specification, "
+                    "cannot determine minimum depth of some non-terminals.\n",
+                    __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
-static void calculate_production_depths(struct gges_bnf_grammar *g)
+static struct gges_bnf_non_terminal *next_non_terminal_token(
+    struct gges_bnf_non_terminal *nt, int *j, int *k)
 {
-    int i, j, k;
-    int labelled, unlabelled;
-    int prod_depth, nt_depth;
-
-    struct gges_bnf_non_terminal *nt;
-    struct gges_bnf_production *p;
     struct gges_bnf_token *t;
 
-    do {
-        labelled = unlabelled = 0;
-
-        for (i = 0; i < g->size; ++i) {
-            nt = g->non_terminals + i;
-            for (j = 0; j < nt->size; ++j) {
-                p = g->non_terminals[i].productions + j;
+    while (*j < nt->size) {
+        if (*k < nt->productions[*j].size) {
+            t = nt->productions[*j].tokens + (*k)++;
+            if (!t->terminal) return t->nt;
+        } else {
+            (*j)++;
+            *k = 0;
+        }
+    }
 
-                /* if the minimum depth of the production is already
-                 * known, then there is no need to recalculate it */
-                if (p->min_depth > 0) continue;
+    return NULL;
+}
 
-                /* by definition, the smallest possible depth of a
-                 * production is 1 (when it contains no non-terminal
-                 * symbols) */
-                prod_depth = 1;
-                for (k = 0; k < p->size; ++k) {
-                    t = p->tokens + k;
-                    if (t->terminal) continue;
-
-                    /* get the representative minimum depth for the
-                     * current non-terminal token. The representative
-                     * depth is defined as the smallest minimum depth
-                     * of all the non-terminal's productions */
-                    nt_depth = get_non_terminal_depth(t->nt);
-
-                    if (nt_depth == 0) {
-                        /* no productions for the the required
-                         * non-terminal have been labelled with their
-                         * minimum depth, so we do not know the
-                         * representative depth for the non-terminal,
-                         * and so we cannot calculate the minimum
-                         * depth of this production at this stage */
-                        prod_depth = 0;
-                        break;
-                    } else if (nt_depth >= prod_depth) {
-                        prod_depth = nt_depth + 1;
-                    }
+/* labels each affected non-terminal with the id of its strongly
+ * connected component, using Tarjan's algorithm (with an explicit call
+ * stack, as generated grammars can be very deep). The affected
+ * non-terminals are listed in order, grouped by component, with the
+ * components in the order they were completed (so each comes after
+ * every component that it can reach). Edges to unaffected
+ * non-terminals are ignored. Returns the number of non-terminals
+ * listed in order */
+static int find_components(struct gges_bnf_grammar *g, const bool *affected,
+                           int *component, int *order)
+{
+    int i, v, u, n, sp, cp, base, counter, components;
+    int *index, *low, *stack, *call, *pos_j, *pos_k;
+    bool *on_stack;
+    struct gges_bnf_non_terminal *child;
+
+    index = ALLOC(g->size + 1, sizeof(int), true);
+    low = ALLOC(g->size + 1, sizeof(int), false);
+    on_stack = ALLOC(g->size + 1, sizeof(bool), true);
+    stack = ALLOC(g->size + 1, sizeof(int), false);
+    call = ALLOC(g->size + 1, sizeof(int), false);
+    pos_j = ALLOC(g->size + 1, sizeof(int), false);
+    pos_k = ALLOC(g->size + 1, sizeof(int), false);
+
+    for (i = 0; i < g->size; ++i) component[i] = -1;
+
+    n = counter = sp = cp = components = 0;
+    for (i = 0; i < g->size; ++i) {
+        if (!affected[i] || (index[i] != 0)) continue;
+
+        index[i] = low[i] = ++counter;
+        stack[sp++] = i;
+        on_stack[i] = true;
+        call[cp++] = i;
+        pos_j[i] = pos_k[i] = 0;
+
+        while (cp > 0) {
+            v = call[cp - 1];
+            child = next_non_terminal_token(g->non_terminals + v,
+                                            pos_j + v, pos_k + v);
+            if (child != NULL) {
+                u = child->id;
+                if (!affected[u]) continue;
+
+                if (index[u] == 0) {
+                    index[u] = low[u] = ++counter;
+                    stack[sp++] = u;
+                    on_stack[u] = true;
+                    call[cp++] = u;
+                    pos_j[u] = pos_k[u] = 0;
+                } else if (on_stack[u] && (index[u] < low[v])) {
+                    low[v] = index[u];
                 }
+                continue;
+            }
 
-                if (prod_depth > 0) {
-                    labelled++;
-                    p->min_depth = prod_depth;
-                } else {
-                    unlabelled++;
-                }
+            /* all of the children of v have been explored */
+            cp--;
+            if ((cp > 0) && (low[v] < low[call[cp - 1]])) {
+                low[call[cp - 1]] = low[v];
             }
-        }
+            if (low[v] != index[v]) continue;
 
-        if (labelled == 0 && unlabelled != 0) {
-            fprintf(stderr,
-                    "%s:%d - ERROR: Incomplete grammar specification, "
-                    "cannot determine minimum depth of some non-terminals.\n",
-                    __FILE__, __LINE__);
-            exit(EXIT_FAILURE);
+            /* v is the root of a component, so move its members from
+             * the stack into the ordering */
+            base = sp - 1;
+            while (stack[base] != v) base--;
+
+            for (u = base; u < sp; ++u) {
+                on_stack[stack[u]] = false;
+                component[stack[u]] = components;
+                order[n++] = stack[u];
+            }
+            sp = base;
+            components++;
         }
-    } while (labelled != 0);
+    }
+
+    free(pos_k);
+    free(pos_j);
+    free(call);
+    free(stack);
+    free(on_stack);
+    free(low);
+    free(index);
+
+    return n;
 }
 
-static void calculate_production_recursion(struct gges_bnf_grammar *g)
+static bool uses_non_terminal(struct gges_bnf_non_terminal *nt,
+                              struct gges_bnf_non_terminal *target)
 {
-    int i, j, k;
-    int labelled;
+    int j, k;
+    struct gges_bnf_non_terminal *child;
 
-    struct gges_bnf_non_terminal *nt;
+    j = k = 0;
+    while ((child = next_non_terminal_token(nt, &j, &k)) != NULL) {
+        if (child == target) return true;
+    }
+
+    return false;
+}
+
+static void calculate_production_recursion(struct gges_bnf_grammar *g,
+                                           const bool *affected)
+{
+    int i, j, k, a, b, n;
+    int *component, *order;
+    bool recursive;
+
+    struct gges_bnf_non_terminal *nt, *child;
     struct gges_bnf_production *p;
     struct gges_bnf_token *t;
 
-    /* first pass, does the production use its own LHS? */
+    /* a non-terminal is recursive if it can expand back into itself
+     * (i.e., it shares a strongly connected component with another
+     * non-terminal, or uses itself directly), or if it can expand
+     * into a recursive non-terminal. Components are completed only
+     * after every component reachable from them, so the flags of the
+     * children are always known when a component is labelled.
+     * Unaffected non-terminals cannot reach the affected ones, so
+     * their flags are still valid and they are left alone */
+    component = ALLOC(g->size + 1, sizeof(int), false);
+    order = ALLOC(g->size + 1, sizeof(int), false);
+    n = find_components(g, affected, component, order);
+
+    for (i = 0; i < n; ++i) g->non_terminals[order[i]].recursive = false;
+
+    for (a = 0; a < n; a = b) {
+        for (b = a + 1; (b < n) && (component[order[b]] == component[order[a]]); ++b);
+
+        nt = g->non_terminals + order[a];
+        recursive = (b - a > 1) || uses_non_terminal(nt, nt);
+        if (!recursive) {
+            j = k = 0;
+            while ((child = next_non_terminal_token(nt, &j, &k)) != NULL) {
+                if (child->recursive) {
+                    recursive = true;
+                    break;
+                }
+            }
+        }
+
+        for (i = a; i < b; ++i) g->non_terminals[order[i]].recursive = recursive;
+    }
+
+    free(order);
+    free(component);
+
+    /* a production is recursive if it uses a recursive non-terminal */
     for (i = 0; i < g->size; ++i) {
+        if (!affected[i]) continue;
         nt = g->non_terminals + i;
-        nt->recursive = false;
-
         for (j = 0; j < nt->size; ++j) {
             p = nt->productions + j;
             p->recursive = false;
 
             for (k = 0; k < p->size; ++k) {
                 t = p->tokens + k;
-
-                if (t->terminal) continue;
-
-                if (t->nt == nt) {
+                if (!t->terminal && t->nt->recursive) {
                     p->recursive = true;
-                    nt->recursive = true;
                     break;
                 }
             }
         }
     }
-
-    do {
-        labelled = 0;
-        /* second pass, does the production use a known recursive non-terminal? */
-        for (i = 0; i < g->size; ++i) {
-            nt = g->non_terminals + i;
-            for (j = 0; j < nt->size; ++j) {
-                p = nt->productions + j;
-                if (p->recursive) continue;
-
-                for (k = 0; k < p->size; ++k) {
-                    t = p->tokens + k;
-
-                    if (t->terminal) continue;
-
-                    if (t->nt->recursive) {
-                        p->recursive = true;
-                        nt->recursive = true;
-                        labelled++;
-                        break;
-                    }
-                }
-            }
-        }
-    } while (labelled != 0);
 }
 
-static void calculate_non_terminal_depths(struct gges_bnf_grammar *g)
+static void calculate_non_terminal_depths(struct gges_bnf_grammar *g,
+                                          const bool *affected)
 {
     int i, j;
     struct gges_bnf_non_terminal *nt;
 
     for (i = 0; i < g->size; ++i) {
+        if (!affected[i]) continue;
         nt = g->non_terminals + i;
         if (nt->size == 0) {
             fprintf(stderr,
@@ -794,7 +2427,7 @@ static void calculate_non_terminal_depths(struct gges_bnf_grammar *g)
     }
 }
 
-static void link_non_terminal_tokens(struct gges_bnf_grammar *g)
+static void link_non_terminal_tokens(struct gges_bnf_grammar *g, bool all)
 {
     int i, j, k;
     struct gges_bnf_non_terminal *nt;
@@ -803,6 +2436,8 @@ static void link_non_terminal_tokens(struct gges_bnf_grammar *g)
 
     for (i = 0; i < g->size; ++i) {
         nt = g->non_terminals + i;
+        if (!all && !nt->modified) continue;
+
         for (j = 0; j < nt->size; ++j) {
             p = nt->productions + j;
 
@@ -810,9 +2445,6 @@ static void link_non_terminal_tokens(struct gges_bnf_grammar *g)
              * non-terminal */
             p->nt = nt;
 
-            /* flag the current production as needing a depth check */
-            p->min_depth = 0;
-
             /* check each token in the current production, if it is a
              * non-terminal, then hook it up to the appropriate entry
              * in the grammar, otherwise, leave the reference as
@@ -841,3 +2473,71 @@ static void link_non_terminal_tokens(struct gges_bnf_grammar *g)
         }
     }
 }
+
+static bool *find_affected_non_terminals(struct gges_bnf_grammar *g)
+{
+    int i, j, k, n, head, tail;
+    int *first, *users, *queue;
+    bool *affected;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+    struct gges_bnf_token *t;
+
+    /* build the reverse reference graph, users[first[i]] up to
+     * users[first[i + 1]] lists the non-terminals whose productions
+     * refer to non-terminal i (possibly with repeats) */
+    first = ALLOC(g->size + 1, sizeof(int), true);
+    for (i = 0; i < g->size; ++i) {
+        nt = g->non_terminals + i;
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (!t->terminal) first[t->nt->id + 1]++;
+            }
+        }
+    }
+    for (i = 0; i < g->size; ++i) first[i + 1] += first[i];
+
+    users = ALLOC(first[g->size] + 1, sizeof(int), false);
+    for (i = 0; i < g->size; ++i) {
+        nt = g->non_terminals + i;
+        for (j = 0; j < nt->size; ++j) {
+            p = nt->productions + j;
+            for (k = 0; k < p->size; ++k) {
+                t = p->tokens + k;
+                if (!t->terminal) users[first[t->nt->id]++] = i;
+            }
+        }
+    }
+    /* the fill above shifted each start to the next entry's start */
+    for (i = g->size; i > 0; --i) first[i] = first[i - 1];
+    first[0] = 0;
+
+    /* the affected non-terminals are those that were modified, and
+     * any that can (directly or indirectly) expand to them */
+    affected = ALLOC(g->size, sizeof(bool), true);
+    queue = ALLOC(g->size + 1, sizeof(int), false);
+    head = tail = 0;
+    for (i = 0; i < g->size; ++i) {
+        if (g->non_terminals[i].modified) {
+            affected[i] = true;
+            queue[tail++] = i;
+        }
+    }
+
+    while (head < tail) {
+        n = queue[head++];
+        for (j = first[n]; j < first[n + 1]; ++j) {
+            if (affected[users[j]]) continue;
+            affected[users[j]] = true;
+            queue[tail++] = users[j];
+        }
+    }
+
+    free(queue);
+    free(users);
+    free(first);
+
+    return affected;
+}
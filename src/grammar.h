@@ -7,11 +7,46 @@ extern "C" {
 
     #include <stdio.h>
     #include <stdbool.h>
+    #include <stdint.h>
 
     /***************************************************************************
      * Structure definitions
      **************************************************************************/
     typedef char *(*gges_bnf_data_field_generator)(double (*rnd)(void));
+    typedef double (*gges_bnf_double_field_generator)(double (*rnd)(void));
+    typedef int (*gges_bnf_int_field_generator)(double (*rnd)(void));
+
+    /* the kind of value produced by a data field generator. Numeric
+     * values are held as is, and are only converted to text when the
+     * phenotype string is produced */
+    enum gges_bnf_data_field_type {
+        GGES_DATA_FIELD_STRING,
+        GGES_DATA_FIELD_DOUBLE,
+        GGES_DATA_FIELD_INT
+    };
+
+    /* the value instantiated for a data field token (e.g., the
+     * constant chosen for an ephemeral random constant) */
+    struct gges_bnf_data_field {
+        enum gges_bnf_data_field_type type;
+        union {
+            char *s;
+            double d;
+            int i;
+        } value;
+    };
+
+    /* a registered data field generator, of any of the supported
+     * types */
+    struct gges_bnf_data_field_gen {
+        char *key;
+        enum gges_bnf_data_field_type type;
+        union {
+            gges_bnf_data_field_generator s;
+            gges_bnf_double_field_generator d;
+            gges_bnf_int_field_generator i;
+        } fn;
+    };
 
     /* structure to hold information about a single token in a given
      * production - a token can be either a terminal (i.e., is emitted
@@ -97,27 +132,96 @@ extern "C" {
                                         * recursive (i.e., through
                                         * their expansion they refer
                                         * back to this non-terminal */
+
+        bool modified;                 /* true if productions have
+                                        * been added to this
+                                        * non-terminal since the
+                                        * grammar was last linked */
+    };
+
+    /* tables holding the number of distinct derivations of each
+     * non-terminal (and each production) by size, i.e., by the number
+     * of productions used. These are used to sample derivations of an
+     * exact size. The counts grow exponentially with size, so are held
+     * as natural logarithms (with -INFINITY for no derivations) */
+    struct gges_bnf_size_counts {
+        int max_size;    /* the largest size covered by the tables */
+
+        double **nt;     /* nt[i][n] is the (log of the) number of
+                          * derivations of the i-th non-terminal using
+                          * n productions */
+
+        double ***prod;  /* prod[i][j] is the table for the j-th
+                          * production of the i-th non-terminal, where
+                          * element [c * (max_size + 1) + n] holds the
+                          * (log of the) number of ways that the c-th and
+                          * subsequent non-terminals of the production
+                          * can be derived using n productions in
+                          * total */
+    };
+
+    /* an open addressing hash table that maps names (e.g.,
+     * non-terminal labels) to positions within one of the grammar's
+     * arrays */
+    struct gges_bnf_symbol_index {
+        int *slots; /* the stored positions, or -1 for an empty slot */
+        int size;   /* the number of slots, always a power of two */
+        int count;  /* the number of occupied slots */
     };
 
     struct gges_bnf_grammar {
-        char **data_field_gen_keys;
-        gges_bnf_data_field_generator *data_field_gen_fn;
+        struct gges_bnf_data_field_gen *data_field_gens;
         int data_field_gen_n;
+        struct gges_bnf_symbol_index data_field_gen_index;
 
         int size; /* the number of non-terminals in the grammar */
 
         /* a collection of the non-terminals in the grammar */
         struct gges_bnf_non_terminal *non_terminals;
+        struct gges_bnf_symbol_index nt_index;
+
+        /* the number of non-terminals present when the grammar was
+         * last linked, any non-terminals created since then will have
+         * moved the array above, so all token links must be redone */
+        int linked;
 
         /* the start symbol for the grammar, or set to NULL to use the
          * first element of the non-terminal array */
         struct gges_bnf_non_terminal *start;
+
+        /* derivation counts, built on demand (NULL until needed) */
+        struct gges_bnf_size_counts *size_counts;
+
+        /* the number of elements in the SGE gene of each
+         * non-terminal, and their total, or NULL until computed */
+        int *sge_gene_sizes;
+        int sge_genome_size;
+
+        /* if the grammar was loaded from a compiled grammar file,
+         * then its non-terminals, productions and tokens live in this
+         * single block holding the file's image, rather than in their
+         * own allocations, until the grammar is first modified (when
+         * they are copied out and detached is set). The image is kept
+         * until the grammar is released */
+        void *image;
+        size_t image_size;
+        bool detached;
     };
 
 
     struct gges_bnf_grammar *gges_create_empty_grammar(void);
 
+    /* registers the function used to instantiate the data fields
+     * with the given key. String generators return a heap-allocated
+     * string, while the numeric generators return their values
+     * directly, which saves evaluators from having to parse them back
+     * out of the phenotype. Generators are not part of the grammar
+     * text, nor of a compiled grammar file, so they must be registered
+     * on every grammar that is loaded (including one returned by
+     * gges_load_compiled_grammar or gges_load_bnf_cached) */
     void gges_register_data_field_generator(struct gges_bnf_grammar *g, char *key, gges_bnf_data_field_generator fn);
+    void gges_register_double_field_generator(struct gges_bnf_grammar *g, char *key, gges_bnf_double_field_generator fn);
+    void gges_register_int_field_generator(struct gges_bnf_grammar *g, char *key, gges_bnf_int_field_generator fn);
 
     /* reads a file containing a BNF grammar specification, and returns the
      * corresponding data structure
@@ -125,13 +229,87 @@ extern "C" {
     struct gges_bnf_grammar *gges_load_bnf(const char *file_name);
     void gges_write_bnf(FILE *f, struct gges_bnf_grammar *g);
 
+    /* loads the grammar in file_name through the compiled grammar
+     * file cache_name. If the cache was built from the same BNF text,
+     * then it is loaded and used as is, otherwise the BNF is parsed
+     * and the cache is (re)written. A NULL cache_name is the same as
+     * calling gges_load_bnf */
+    struct gges_bnf_grammar *gges_load_bnf_cached(const char *file_name,
+                                                  const char *cache_name);
+
+    /* writes a linked grammar to a compiled grammar file, tagged with
+     * the hash of the BNF text that it came from. Returns false if
+     * the file could not be written */
+    bool gges_write_compiled_grammar(struct gges_bnf_grammar *g,
+                                     const char *file_name,
+                                     uint64_t source_hash);
+
+    /* loads a compiled grammar file, returning NULL if the file does
+     * not exist, was built from a different source hash, was written
+     * by an incompatible build of the library, or is damaged. The
+     * file holds the data field tokens, but not their generators,
+     * which must be registered again on the loaded grammar */
+    struct gges_bnf_grammar *gges_load_compiled_grammar(const char *file_name,
+                                                        uint64_t source_hash);
+
+    /* the hash of a BNF string, used to validate compiled grammars */
+    uint64_t gges_bnf_source_hash(const char *bnfstr);
+
     /* constructs a suitable grammar object from the given BNF string
      */
     struct gges_bnf_grammar *gges_parse_bnf(const char *bnfstr);
 
+    /* adds the rules in the BNF string to the grammar. If relink is
+     * false, then the grammar is left unlinked, and
+     * gges_relink_grammar must be called before it is used */
     void gges_extend_grammar(struct gges_bnf_grammar *g,
                              const char *bnfstr, bool relink);
 
+    /* adds the right-hand side rhs (e.g., "<expr> '+' <expr>", or
+     * several productions separated by |) to the non-terminal lhs,
+     * creating the non-terminal if needed. The grammar is left
+     * unlinked, so many productions can be added in bulk before
+     * calling gges_relink_grammar once */
+    void gges_add_production(struct gges_bnf_grammar *g,
+                             const char *lhs, const char *rhs);
+
+    /* adds a production made up of the n given tokens to the
+     * non-terminal lhs, without parsing any BNF. Each token's symbol
+     * is copied as is: the label (e.g., "<expr>") for a non-terminal,
+     * the generator key for a data field, or the text of a terminal
+     * (the nt pointers are ignored). As with gges_add_production, the
+     * grammar is left unlinked */
+    void gges_add_production_tokens(struct gges_bnf_grammar *g,
+                                    const char *lhs,
+                                    const struct gges_bnf_token *tokens,
+                                    int n);
+
+    /* adds the productions prefix<first> to prefix<last> (e.g., x1,
+     * x2, ...) to the non-terminal lhs, each a single terminal. The
+     * grammar is left unlinked */
+    void gges_add_numbered_terminals(struct gges_bnf_grammar *g,
+                                     const char *lhs, const char *prefix,
+                                     int first, int last);
+
+    /* hooks up the tokens of any productions added since the grammar
+     * was last linked, and recalculates the depth and recursion
+     * details of the non-terminals that they affect (i.e., those that
+     * can reach a modified non-terminal) */
+    void gges_relink_grammar(struct gges_bnf_grammar *g);
+
+    /* returns a new, non-recursive, grammar in which every cycle of
+     * the given grammar is unrolled to the given depth (e.g., for
+     * SGE). Each non-terminal on a cycle gets a copy for each level
+     * (<expr>, <expr_0>, ..., <expr_{depth-1}>), and using a
+     * non-terminal from the same cycle moves down a level. Productions
+     * that would recurse past the last level are dropped, along with
+     * any that then cannot be completed. The terminals and data field
+     * generators are copied as they are. Returns NULL if the grammar
+     * cannot produce a derivation within the given depth, or if an
+     * unrolled label clashes with an existing non-terminal */
+    struct gges_bnf_grammar *gges_unroll_grammar(struct gges_bnf_grammar *g,
+                                                 int depth);
+
     /* BNF grammar destructor */
     void gges_release_grammar(struct gges_bnf_grammar *g);
 
@@ -147,7 +325,46 @@ extern "C" {
                                struct gges_bnf_non_terminal *nt,
                                int max_depth, bool recursive_only);
 
-    char *gges_bnf_init_data_field(struct gges_bnf_grammar *g, char *key, double (*rnd)(void));
+    /* returns the number of distinct derivations from the given
+     * non-terminal that use exactly size productions (which may be
+     * HUGE_VAL if the count is too large to be held in a double) */
+    double gges_bnf_count_derivations(struct gges_bnf_grammar *g,
+                                      struct gges_bnf_non_terminal *nt,
+                                      int size);
+
+    /* picks a size in [min_size, max_size] (uniformly from the sizes
+     * that the grammar can produce), then samples uniformly from all
+     * derivations of the non-terminal of that size. The productions
+     * are written into seq (which must hold max_size elements) in
+     * the order that they are applied in a leftmost derivation
+     *
+     * returns the number of productions in the derivation, or zero if
+     * the grammar cannot produce a derivation of a suitable size */
+    int gges_bnf_sample_derivation(struct gges_bnf_grammar *g,
+                                   struct gges_bnf_non_terminal *nt,
+                                   int min_size, int max_size,
+                                   struct gges_bnf_production **seq,
+                                   double (*rnd)(void));
+
+    /* instantiates the given data field using the generator
+     * registered under the supplied key */
+    void gges_bnf_init_data_field(struct gges_bnf_grammar *g, char *key,
+                                  struct gges_bnf_data_field *field,
+                                  double (*rnd)(void));
+
+    /* copies the value of a data field (duplicating string values),
+     * and releases any memory held by a data field */
+    void gges_bnf_copy_data_field(struct gges_bnf_data_field *dest,
+                                  struct gges_bnf_data_field *src);
+    void gges_bnf_release_data_field(struct gges_bnf_data_field *field);
+
+    /* returns the text of a data field as it should appear in the
+     * phenotype. Numeric values are written into the supplied buffer
+     * (which should hold at least GGES_DATA_FIELD_TEXT_LEN
+     * characters) using the shortest form that reads back as the same
+     * value */
+    #define GGES_DATA_FIELD_TEXT_LEN 32
+    const char *gges_bnf_data_field_text(struct gges_bnf_data_field *field, char *buffer);
 
 #ifdef __cplusplus
 }
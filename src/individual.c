@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <string.h>
@@ -26,6 +27,10 @@ static void copy_mapping(struct gges_mapping *src, struct gges_mapping *dest);
 
 static void release_mapping(struct gges_mapping *mapping);
 
+static void inherit_phenotype(struct gges_individual *parent,
+                              struct gges_individual *offspring,
+                              bool neutral);
+
 
 
 
@@ -45,7 +50,7 @@ struct gges_individual *gges_create_individual(struct gges_parameters *params)
     ind = ALLOC(1, sizeof(struct gges_individual), false);
     ind->type = params->model;
     if (ind->type == GRAMMATICAL_EVOLUTION) {
-        ind->representation.list = gges_ge_create_codon_list();
+        ind->representation.list = gges_ge_create_codon_list(params->codon_width);
     } else if (ind->type == STRUCTURED_GRAMMATICAL_EVOLUTION) {
         ind->representation.genome = gges_sge_create_genome();
     } else {
@@ -101,11 +106,17 @@ bool gges_map_individual(struct gges_parameters *params,
 
     if (ind->type == GRAMMATICAL_EVOLUTION) {
         ind->mapped = gges_ge_map_codons(g, ind->representation.list, ind->mapping,
-                                  params->mapping_wrap_count);
+                                  params->mapping_wrap_count,
+                                  params->maximum_phenotype_length);
+        if (ind->mapped && (params->tail_prune_slack >= 0)) {
+            gges_ge_prune_tail(ind->representation.list, params->tail_prune_slack);
+        }
     } else if (ind->type == STRUCTURED_GRAMMATICAL_EVOLUTION) {
-        ind->mapped = gges_sge_map_genome(g, ind->representation.genome, ind->mapping);
+        ind->mapped = gges_sge_map_genome(g, ind->representation.genome, ind->mapping,
+                                          params->maximum_phenotype_length);
     } else {
-        ind->mapped = gges_cfggp_map_tree(ind->representation.tree, ind->mapping);
+        ind->mapped = gges_cfggp_map_tree(ind->representation.tree, ind->mapping,
+                                          params->maximum_phenotype_length);
     }
 
     return ind->mapped;
@@ -135,7 +146,13 @@ void gges_init_individual(struct gges_parameters *params,
                           struct gges_individual *ind)
 {
     if (ind->type == GRAMMATICAL_EVOLUTION) {
-        if (params->sensible_initialisation) {
+        if (params->init_max_size > 0) {
+            gges_ge_sized_init(g, ind->representation.list,
+                               params->init_min_size,
+                               params->init_max_size,
+                               params->sensible_init_tail_length,
+                               params->rnd);
+        } else if (params->sensible_initialisation) {
             gges_ge_sensible_init(g, ind->representation.list,
                                   params->init_min_depth,
                                   params->init_max_depth,
@@ -155,13 +172,25 @@ void gges_init_individual(struct gges_parameters *params,
             }
         }
     } else if (ind->type == STRUCTURED_GRAMMATICAL_EVOLUTION) {
-        if (params->sge_gene_sizes == NULL) {
-            params->sge_genome_size = gges_sge_compute_gene_sizes(g, &(params->sge_gene_sizes));
+        if (!params->sge_dynamic_genome &&
+            ((params->sge_layout == NULL) || (params->sge_layout->n_genes != g->size))) {
+            fprintf(stderr, "%s:%d - ERROR: No SGE layout has been created for this "
+                    "grammar (see gges_sge_create_layout, which gges_run_system "
+                    "calls), so a fixed-size genome cannot be initialised. Quitting...\n",
+                    __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
         }
         gges_sge_random_init(g, ind->representation.genome,
-                             params->sge_gene_sizes, params->rnd);
+                             params->sge_dynamic_genome ? NULL : params->sge_layout,
+                             params->rnd);
     } else {
-        if (params->sensible_initialisation) {
+        if (params->init_max_size > 0) {
+            gges_cfggp_sized_init(g, &(ind->representation.tree),
+                                  params->init_min_size,
+                                  params->init_max_size,
+                                  params->maximum_tree_depth,
+                                  params->rnd);
+        } else if (params->sensible_initialisation) {
             gges_cfggp_sensible_init(g, &(ind->representation.tree),
                                      params->init_min_depth,
                                      params->init_max_depth,
@@ -211,53 +240,47 @@ void gges_breed(struct gges_parameters *params,
                 struct gges_individual *daughter,
                 struct gges_individual *son)
 {
-    bool cloned;
+    bool d_neutral, s_neutral;
     if (params->model == GRAMMATICAL_EVOLUTION) {
         /* delegate to GE breeding functions */
-        cloned = gges_ge_breed(mother->representation.list,
-                               father->representation.list,
-                               daughter->representation.list,
-                               son->representation.list,
-                               params->fixed_point_crossover,
-                               params->crossover_rate, params->mutation_rate,
-                               params->rnd);
+        gges_ge_breed(mother->representation.list,
+                      father->representation.list,
+                      daughter->representation.list,
+                      son->representation.list,
+                      params->fixed_point_crossover,
+                      params->effective_crossover,
+                      params->crossover_rate, params->mutation_rate,
+                      params->rnd, &d_neutral, &s_neutral);
     } else if (params->model == STRUCTURED_GRAMMATICAL_EVOLUTION) {
         /* delegate to Structured GE breeding functions */
-        cloned = gges_sge_breed(g,
-                                mother->representation.genome,
-                                father->representation.genome,
-                                daughter->representation.genome,
-                                son->representation.genome,
-                                params->crossover_rate, params->mutation_rate,
-                                params->rnd);
+        gges_sge_breed(g,
+                       mother->representation.genome,
+                       father->representation.genome,
+                       daughter->representation.genome,
+                       son->representation.genome,
+                       params->crossover_rate, params->mutation_rate,
+                       params->rnd, &d_neutral, &s_neutral);
     } else {
         /* delegate to CFGGP operators */
-        cloned = gges_cfggp_breed(g, mother->representation.tree, father->representation.tree,
-                                  &(daughter->representation.tree), &(son->representation.tree),
-                                  params->maximum_mutation_depth, params->maximum_tree_depth,
-                                  params->node_selection_method,
-                                  params->crossover_rate, params->mutation_rate, params->rnd);
+        d_neutral = s_neutral = gges_cfggp_breed(g, mother->representation.tree,
+                                                 father->representation.tree,
+                                                 &(daughter->representation.tree),
+                                                 &(son->representation.tree),
+                                                 params->maximum_mutation_depth,
+                                                 params->maximum_tree_depth,
+                                                 params->maximum_tree_size,
+                                                 params->node_selection_method,
+                                                 params->mutation_method,
+                                                 params->crossover_rate,
+                                                 params->mutation_rate, params->rnd);
     }
 
-    if (cloned) {
-        copy_mapping(mother->mapping, daughter->mapping);
-        daughter->mapped = mother->mapped;
-        daughter->evaluated = mother->evaluated;
-        daughter->fitness = mother->fitness;
-
-        daughter->objective = mother->objective;
-
-        copy_mapping(father->mapping, son->mapping);
-        son->mapped = father->mapped;
-        son->evaluated = father->evaluated;
-        son->fitness = father->fitness;
-
-        son->objective = father->objective;
-    } else {
-        daughter->mapped = son->mapped = false;
-        daughter->evaluated = son->evaluated = false;
-        daughter->fitness   = son->fitness   = GGES_WORST_FITNESS;
-    }
+    /* offspring that are clones of their first parent (or that only
+     * differ in parts of the genome that are never expressed) keep
+     * the mapping and fitness of that parent, so they are not mapped
+     * or evaluated again */
+    inherit_phenotype(mother, daughter, d_neutral);
+    inherit_phenotype(father, son, s_neutral);
 }
 
 
@@ -330,3 +353,23 @@ static void release_mapping(struct gges_mapping *mapping)
     free(mapping->buffer);
     free(mapping);
 }
+
+
+
+static void inherit_phenotype(struct gges_individual *parent,
+                              struct gges_individual *offspring,
+                              bool neutral)
+{
+    if (neutral) {
+        copy_mapping(parent->mapping, offspring->mapping);
+        offspring->mapped = parent->mapped;
+        offspring->evaluated = parent->evaluated;
+        offspring->fitness = parent->fitness;
+
+        offspring->objective = parent->objective;
+    } else {
+        offspring->mapped = false;
+        offspring->evaluated = false;
+        offspring->fitness = GGES_WORST_FITNESS;
+    }
+}
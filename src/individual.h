@@ -55,6 +55,13 @@ extern "C" {
     struct gges_individual *gges_create_individual(struct gges_parameters *params);
     void gges_release_individual(struct gges_individual *ind);
 
+    /* initialises the individual's representation from the grammar,
+     * and maps it. Fixed-size SGE genomes are laid out by the gene
+     * sizes of the grammar, which gges_run_system works out once per
+     * run (see gges_sge_compute_gene_sizes) and keeps in
+     * params->sge_gene_sizes and params->sge_layout. Initialising an
+     * SGE individual outside of gges_run_system requires those to be
+     * set up for g first */
     void gges_init_individual(struct gges_parameters *params,
                               struct gges_bnf_grammar *g,
                               struct gges_individual *ind);
@@ -6,6 +6,7 @@
 #include "sge.h"
 
 #include "alloc.h"
+#include "geometric.h"
 
 #define ONE_PER_GENE_MUTATION
 
@@ -13,10 +14,10 @@
 /*******************************************************************************
  * internal helper function prototypes
  ******************************************************************************/
-static void map_sequence(struct gges_mapping *m,
+static bool map_sequence(struct gges_mapping *m,
                          struct gges_sge_genome *genome,
                          struct gges_bnf_non_terminal *nt,
-                         int *offset, int *cnt);
+                         int *offset, int *cnt, int max_length);
 
 static void map_derivation(struct gges_derivation_tree **dest,
                            struct gges_bnf_grammar *g,
@@ -24,8 +25,29 @@ static void map_derivation(struct gges_derivation_tree **dest,
                            struct gges_bnf_non_terminal *nt,
                            int *offset, int *cnt);
 
-static int compute_gene_size(struct gges_bnf_non_terminal *nt,
-                             struct gges_bnf_non_terminal *lhs);
+static int next_codon(struct gges_sge_genome *genome,
+                      struct gges_bnf_non_terminal *nt,
+                      int *offset, int *cnt);
+
+static int gene_length(struct gges_sge_genome *genome, int i);
+static void reserve_genes(struct gges_sge_genome *genome, int size);
+static void append_gene(struct gges_sge_genome *dest,
+                        struct gges_sge_genome *src, int i);
+static void trim_genome(struct gges_sge_genome *genome);
+static bool same_expression(struct gges_sge_genome *a,
+                            struct gges_sge_genome *b, int i);
+static void use_layout(struct gges_sge_genome *genome,
+                       struct gges_sge_layout *layout, int n_genes);
+static void copy_block(struct gges_sge_genome *m,
+                       struct gges_sge_genome *f,
+                       struct gges_sge_genome *d,
+                       struct gges_sge_genome *s,
+                       int start, int end, bool swap);
+
+static int *topological_order(struct gges_bnf_grammar *g);
+static void compute_gene_sizes(struct gges_bnf_grammar *g, int *order,
+                               struct gges_bnf_non_terminal *nt,
+                               int *expansions);
 
 static void ensure_correct_size(struct gges_sge_genome *genome,
                                 struct gges_sge_genome *base);
@@ -38,18 +60,28 @@ static void ensure_correct_size(struct gges_sge_genome *genome,
 int gges_sge_compute_gene_sizes(struct gges_bnf_grammar *g,
                                 int **gene_sizes_ptr)
 {
-    int i, *gene_sizes, genome_size;
+    int i, *gene_sizes, genome_size, *order, *expansions;
     struct gges_bnf_non_terminal *start;
 
+    /* the sizes are kept on the grammar once known (and so may have
+     * been loaded with a compiled grammar) */
+    if (g->sge_gene_sizes != NULL) {
+        *gene_sizes_ptr = ALLOC(g->size, sizeof(int), false);
+        memcpy(*gene_sizes_ptr, g->sge_gene_sizes, g->size * sizeof(int));
+        return g->sge_genome_size;
+    }
+
     /* SGE only works on non-recursive grammars (it uses an expansion
      * trick to turn a recursive grammar into a non-recursive grammar,
-     * which can be done offline) - if the grammar is recursive, then
-     * we'd better let the user know so that they can fix it. */
+     * which can be done offline, or with gges_unroll_grammar) - if
+     * the grammar is recursive, then we'd better let the user know
+     * so that they can fix it. */
     for (i = 0; i < g->size; ++i)  {
         if (g->non_terminals[i].recursive) {
             fprintf(stderr, "%s:%d - ERROR: SGE cannot operate on a recursive grammar, but "
                     "one has been supplied. You must convert the grammar into a "
-                    "non-recursive alternative before it can be used. Quitting...\n",
+                    "non-recursive alternative (e.g., by setting sge_recursion_depth) "
+                    "before it can be used. Quitting...\n",
                     __FILE__, __LINE__);
             exit(EXIT_FAILURE);
         }
@@ -64,10 +96,19 @@ int gges_sge_compute_gene_sizes(struct gges_bnf_grammar *g,
         start = g->start;
     }
 
+    /* the gene size of a non-terminal is the most times that it can
+     * be expanded in a derivation from the start symbol. This is
+     * found for each non-terminal in turn by dynamic programming over
+     * the (acyclic) grammar, visiting the non-terminals so that each
+     * is seen after all of the non-terminals that it uses */
+    order = topological_order(g);
+    expansions = ALLOC(g->size, sizeof(int), false);
+
     genome_size = 0;
     gene_sizes = ALLOC(g->size, sizeof(int), false);
     for (i = 0; i < g->size; ++i)  {
-        gene_sizes[i] = compute_gene_size(g->non_terminals + i, start);
+        compute_gene_sizes(g, order, g->non_terminals + i, expansions);
+        gene_sizes[i] = expansions[start->id];
         /* fprintf(stderr, "%2d = %s = %d\n", i, g->non_terminals[i].label, gene_sizes[i]); */
         /* this takes account for non-terminals that are not used on
          * the RHS of a production (e.g., start symbols) */
@@ -75,12 +116,53 @@ int gges_sge_compute_gene_sizes(struct gges_bnf_grammar *g,
         genome_size += gene_sizes[i];
     }
 
+    free(expansions);
+    free(order);
+
+    g->sge_gene_sizes = ALLOC(g->size, sizeof(int), false);
+    memcpy(g->sge_gene_sizes, gene_sizes, g->size * sizeof(int));
+    g->sge_genome_size = genome_size;
+
     *gene_sizes_ptr = gene_sizes;
     return genome_size;
 }
 
 
 
+struct gges_sge_layout *gges_sge_create_layout(int n_genes, int *gene_sizes)
+{
+    int i;
+    struct gges_sge_layout *layout;
+
+    layout = ALLOC(1, sizeof(struct gges_sge_layout), false);
+    layout->n_genes = n_genes;
+    layout->gene_offset = ALLOC(n_genes, sizeof(int), false);
+
+    /* compute the offset of each gene, this will also determine the
+     * overall genome length */
+    layout->total_size = 0;
+    for (i = 0; i < n_genes; ++i) {
+        layout->gene_offset[i] = layout->total_size;
+        layout->total_size += gene_sizes[i];
+    }
+
+    layout->refs = 1;
+
+    return layout;
+}
+
+
+
+void gges_sge_release_layout(struct gges_sge_layout *layout)
+{
+    if (layout == NULL || --layout->refs > 0) return;
+
+    free(layout->gene_offset);
+    free(layout);
+}
+
+
+
 struct gges_sge_genome *gges_sge_create_genome(void)
 {
     struct gges_sge_genome *genome;
@@ -89,8 +171,12 @@ struct gges_sge_genome *gges_sge_create_genome(void)
     genome->genes = NULL;
     genome->gene_offset = NULL;
     genome->gene_size   = NULL;
+    genome->layout = NULL;
     genome->n_genes = 0;
     genome->total_size = 0;
+    genome->capacity = 0;
+    genome->borrowed = false;
+    genome->rnd = NULL;
 
     return genome;
 }
@@ -100,36 +186,71 @@ struct gges_sge_genome *gges_sge_create_genome(void)
 void gges_sge_release_genome(struct gges_sge_genome *genome)
 {
     free(genome->gene_size);
-    free(genome->gene_offset);
-    free(genome->genes);
+    if (genome->layout == NULL) free(genome->gene_offset);
+    gges_sge_release_layout(genome->layout);
+    if (!genome->borrowed) free(genome->genes);
     free(genome);
 }
 
 
 
+int *gges_sge_create_genome_matrix(struct gges_sge_layout *layout,
+                                   struct gges_sge_genome **genomes,
+                                   int n)
+{
+    int i, *matrix;
+    struct gges_sge_genome *genome;
+
+    matrix = ALLOC(n * layout->total_size, sizeof(int), false);
+
+    for (i = 0; i < n; ++i) {
+        genome = genomes[i];
+        use_layout(genome, layout, layout->n_genes);
+
+        if (!genome->borrowed) free(genome->genes);
+        genome->genes = matrix + i * layout->total_size;
+        genome->capacity = genome->total_size = layout->total_size;
+        genome->borrowed = true;
+        genome->rnd = NULL;
+    }
+
+    return matrix;
+}
+
+
+
 bool gges_sge_random_init(struct gges_bnf_grammar *g,
                           struct gges_sge_genome *genome,
-                          int *gene_sizes, double (*rnd)(void))
+                          struct gges_sge_layout *layout,
+                          double (*rnd)(void))
 {
     int i, nt;
 
-    free(genome->gene_size);
-    free(genome->gene_offset);
-    free(genome->genes);
-
-    genome->n_genes = g->size;
-    genome->gene_offset = ALLOC(g->size, sizeof(int), true);
-    genome->gene_size   = ALLOC(g->size, sizeof(int), true);
+    use_layout(genome, layout, g->size);
+    memset(genome->gene_size, 0, g->size * sizeof(int));
 
-    /* compute the offset of each gene, this will also determine the
-     * overall genome length */
-    genome->total_size = 0;
-    for (i = 0; i < g->size; ++i) {
-        genome->gene_offset[i] = genome->total_size;
-        genome->total_size += gene_sizes[i];
+    if (layout == NULL) {
+        /* dynamic genome, every gene is empty (and so at offset
+         * zero) until mapping asks for values from it */
+        memset(genome->gene_offset, 0, g->size * sizeof(int));
+        genome->total_size = 0;
+        genome->rnd = rnd;
+        return true;
+    }
+    genome->rnd = NULL;
+
+    genome->total_size = layout->total_size;
+    if (genome->capacity < genome->total_size) {
+        /* a row of a population matrix that is too short for this
+         * layout can't be extended, so the genome takes its own
+         * copy */
+        if (genome->borrowed) {
+            genome->genes = NULL;
+            genome->borrowed = false;
+        }
+        genome->capacity = genome->total_size;
+        genome->genes = REALLOC(genome->genes, genome->capacity, sizeof(int));
     }
-
-    genome->genes = ALLOC(genome->total_size, sizeof(int), false);
 
     for (i = genome->total_size, nt = g->size - 1; i--;) {
         if (i < genome->gene_offset[nt]) nt--;
@@ -143,9 +264,11 @@ bool gges_sge_random_init(struct gges_bnf_grammar *g,
 
 bool gges_sge_map_genome(struct gges_bnf_grammar *g,
                          struct gges_sge_genome *genome,
-                         struct gges_mapping *mapping)
+                         struct gges_mapping *mapping,
+                         int max_length)
 {
     struct gges_bnf_non_terminal *start;
+    bool mapped;
 
     if (g->start == NULL) {
         /* the supplied grammar has no explicitly nominated start
@@ -157,9 +280,11 @@ bool gges_sge_map_genome(struct gges_bnf_grammar *g,
     }
 
     memset(genome->gene_size, 0, genome->n_genes * sizeof(int));
-    map_sequence(mapping, genome, start, genome->gene_offset, genome->gene_size);
+    mapped = map_sequence(mapping, genome, start, genome->gene_offset, genome->gene_size,
+                          max_length);
+    if (mapped && genome->rnd != NULL) trim_genome(genome);
 
-    return true;
+    return mapped;
 }
 
 
@@ -181,6 +306,7 @@ struct gges_derivation_tree *gges_sge_derive(struct gges_bnf_grammar *g,
 
     memset(genome->gene_size, 0, genome->n_genes * sizeof(int));
     map_derivation(&dt, g, genome, start, genome->gene_offset, genome->gene_size);
+    if (genome->rnd != NULL) trim_genome(genome);
 
     return dt;
 }
@@ -195,36 +321,68 @@ void gges_sge_reproduction(struct gges_sge_genome *p,
     memcpy(o->gene_size, p->gene_size, p->n_genes * sizeof(int));
 }
 
+/* d_neutral (s_neutral) is set to true if every gene that the
+ * daughter (son) takes from the father (mother) matches the mother
+ * (father) wherever it was expressed in her (his) mapping */
 void gges_sge_crossover(struct gges_sge_genome *m,
                         struct gges_sge_genome *f,
                         struct gges_sge_genome *d,
                         struct gges_sge_genome *s,
-                        double (*rnd)(void))
+                        double (*rnd)(void),
+                        bool *d_neutral, bool *s_neutral)
 {
     int i, gene_start, gene_end;
+    bool swap, next;
 
     ensure_correct_size(d, m);
     ensure_correct_size(s, f);
 
+    *d_neutral = *s_neutral = true;
+
+    if (m->rnd != NULL) {
+        /* dynamic genomes have genes of different lengths, so the
+         * offspring are built up gene by gene from their parents */
+        d->total_size = s->total_size = 0;
+        for (i = 0; i < m->n_genes; ++i) {
+            if (rnd() < 0.5) {
+                append_gene(d, m, i);
+                append_gene(s, f, i);
+            } else {
+                append_gene(d, f, i);
+                append_gene(s, m, i);
+                if (!same_expression(m, f, i)) *d_neutral = false;
+                if (!same_expression(f, m, i)) *s_neutral = false;
+            }
+        }
+        return;
+    }
+
     /* uniform crossover on genes, so we need to take account of the
      * gene boundaries. Given that we're storing everything in one
      * single array, and we don't store the actual gene sizes (only
      * their offsets), starting from the end of the array makes this a
-     * little easier to perform */
-    gene_start = m->total_size;
+     * little easier to perform. As the parents share a layout,
+     * neighbouring genes that come from the same parent sit next to
+     * each other in both, so each run of them is copied as one
+     * block */
+    gene_start = gene_end = m->total_size;
+    swap = false;
     for (i = m->n_genes; i--;) {
-        gene_end = gene_start;
+        next = (rnd() >= 0.5);
+        if (next != swap) {
+            copy_block(m, f, d, s, gene_start, gene_end, swap);
+            gene_end = gene_start;
+            swap = next;
+        }
         gene_start = m->gene_offset[i];
 
-        if (rnd() < 0.5) {
-            memcpy(d->genes + gene_start, m->genes + gene_start, (gene_end - gene_start) * sizeof(int));
-            memcpy(s->genes + gene_start, f->genes + gene_start, (gene_end - gene_start) * sizeof(int));
-        } else {
-            memcpy(d->genes + gene_start, f->genes + gene_start, (gene_end - gene_start) * sizeof(int));
-            memcpy(s->genes + gene_start, m->genes + gene_start, (gene_end - gene_start) * sizeof(int));
+        if (swap) {
+            if (!same_expression(m, f, i)) *d_neutral = false;
+            if (!same_expression(f, m, i)) *s_neutral = false;
         }
         d->gene_size[i] = s->gene_size[i] = (m->gene_size[i] > f->gene_size[i]) ? m->gene_size[i] : f->gene_size[i];
     }
+    copy_block(m, f, d, s, 0, gene_end, swap);
 }
 
 
@@ -245,52 +403,90 @@ void gges_sge_crossover(struct gges_sge_genome *m,
  * compile-time option
  */
 #ifdef ONE_PER_GENE_MUTATION
-void gges_sge_mutation(struct gges_bnf_grammar *g,
+bool gges_sge_mutation(struct gges_bnf_grammar *g,
                        struct gges_sge_genome *o,
-                       double pm, double (*rnd)(void))
+                       double pm, double (*rnd)(void),
+                       int *expressed)
 {
-    int i, pos, cur;
+    int i, k, pos, cur, skip;
+    double log_q;
+    bool changed;
+
+    if (pm <= 0) return false;
 
+    /* the number of mutable genes to pass over before the next one
+     * that is mutated */
+    log_q = (pm < 1) ? log(1 - pm) : 0;
+    skip = geometric_gap(log_q, o->n_genes, rnd);
+
+    changed = false;
     for (i = 0; i < o->n_genes; ++i) {
         if (g->non_terminals[i].size < 2) continue;
-        if (rnd() >= pm) continue;
-        pos = o->gene_offset[i] + (int)(rnd() * o->gene_size[i]);
+        if (gene_length(o, i) == 0) continue; /* unused dynamic gene */
+        if (skip-- > 0) continue;
+        skip = geometric_gap(log_q, o->n_genes, rnd);
+
+        k = (int)(rnd() * o->gene_size[i]);
+        pos = o->gene_offset[i] + k;
         cur = o->genes[pos];
         do { o->genes[pos] = rnd() * g->non_terminals[i].size; } while (o->genes[pos] == cur);
+        if (k < expressed[i]) changed = true;
     }
+
+    return changed;
 }
 #else
-void gges_sge_mutation(struct gges_bnf_grammar *g,
+bool gges_sge_mutation(struct gges_bnf_grammar *g,
                        struct gges_sge_genome *o,
-                       double pm, double (*rnd)(void))
+                       double pm, double (*rnd)(void),
+                       int *expressed)
 {
     int i, nt;
-    for (i = o->total_size, nt = g->size - 1; i--;) {
-        if (i < o->gene_offset[nt]) nt--;
-        if (rnd() < pm) o->genes[i] = rnd() * g->non_terminals[nt].size;
+    double log_q;
+    bool changed;
+
+    if (pm <= 0) return false;
+
+    /* jump straight from one mutated position to the next */
+    log_q = (pm < 1) ? log(1 - pm) : 0;
+
+    changed = false;
+    nt = g->size - 1;
+    for (i = o->total_size - 1 - geometric_gap(log_q, o->total_size, rnd); i >= 0;
+         i -= 1 + geometric_gap(log_q, o->total_size, rnd)) {
+        while (i < o->gene_offset[nt]) nt--;
+        o->genes[i] = rnd() * g->non_terminals[nt].size;
+        if (i - o->gene_offset[nt] < expressed[nt]) changed = true;
     }
+
+    return changed;
 }
 #endif
 
-bool gges_sge_breed(struct gges_bnf_grammar *g,
+void gges_sge_breed(struct gges_bnf_grammar *g,
                     struct gges_sge_genome *m,
                     struct gges_sge_genome *f,
                     struct gges_sge_genome *d,
                     struct gges_sge_genome *s,
                     double pc, double pm,
-                    double (*rnd)(void))
+                    double (*rnd)(void),
+                    bool *d_neutral, bool *s_neutral)
 {
     if (rnd() < pc) {
-        gges_sge_crossover(m, f, d, s, rnd);
+        gges_sge_crossover(m, f, d, s, rnd, d_neutral, s_neutral);
     } else {
         gges_sge_reproduction(m, d);
         gges_sge_reproduction(f, s);
+        *d_neutral = *s_neutral = true;
     }
 
-    gges_sge_mutation(g, d, pm, rnd);
-    gges_sge_mutation(g, s, pm, rnd);
+    /* the values expressed by each offspring are those that were
+     * expressed by its first parent, as long as it is neutral */
+    if (gges_sge_mutation(g, d, pm, rnd, m->gene_size)) *d_neutral = false;
+    if (gges_sge_mutation(g, s, pm, rnd, f->gene_size)) *s_neutral = false;
 
-    return false;
+    if (*d_neutral) memcpy(d->gene_size, m->gene_size, m->n_genes * sizeof(int));
+    if (*s_neutral) memcpy(s->gene_size, f->gene_size, f->n_genes * sizeof(int));
 }
 
 
@@ -305,30 +501,35 @@ bool gges_sge_breed(struct gges_bnf_grammar *g,
 /*******************************************************************************
  * internal helper function implementations
  ******************************************************************************/
-static void map_sequence(struct gges_mapping *m,
+static bool map_sequence(struct gges_mapping *m,
                          struct gges_sge_genome *genome,
                          struct gges_bnf_non_terminal *nt,
-                         int *offset, int *cnt)
+                         int *offset, int *cnt, int max_length)
 {
     int i;
     struct gges_bnf_production *p;
 
     /* look up the required production */
-    p = nt->productions + genome->genes[offset[nt->id] + cnt[nt->id]++];
+    p = nt->productions + next_codon(genome, nt, offset, cnt);
 
     for (i = 0; i < p->size; ++i) {
         if (p->tokens[i].terminal) {
             /* current token is a terminal, and needs to be printed
              * into the destination stream */
             gges_mapping_append_symbol(m, p->tokens[i].symbol);
+
+            /* stop as soon as the phenotype becomes too long */
+            if (max_length > 0 && m != NULL && m->l > max_length) return false;
         } else {
             /* the current token is a non-terminal, and so needs
              * further expansion. We do this via a recursive call to
              * the relevant production of the corresponding
              * non-terminal */
-            map_sequence(m, genome, p->tokens[i].nt, offset, cnt);
+            if (!map_sequence(m, genome, p->tokens[i].nt, offset, cnt, max_length)) return false;
         }
     }
+
+    return true;
 }
 
 
@@ -346,7 +547,7 @@ static void map_derivation(struct gges_derivation_tree **dest,
     *dest = NULL;
 
     /* look up the required production */
-    p = nt->productions + genome->genes[offset[nt->id] + cnt[nt->id]++];
+    p = nt->productions + next_codon(genome, nt, offset, cnt);
 
     /* create a new element in the derivation tree, rooted with the
      * current non-terminal */
@@ -380,34 +581,266 @@ static void map_derivation(struct gges_derivation_tree **dest,
 
 
 
-static int compute_gene_size(struct gges_bnf_non_terminal *nt,
-                             struct gges_bnf_non_terminal *lhs)
+/* returns the next value of the gene for nt, extending the gene with
+ * a new random value first if the genome is dynamic and the gene has
+ * been used up */
+static int next_codon(struct gges_sge_genome *genome,
+                      struct gges_bnf_non_terminal *nt,
+                      int *offset, int *cnt)
+{
+    int i, pos;
+
+    pos = offset[nt->id] + cnt[nt->id]++;
+    if (genome->rnd == NULL || cnt[nt->id] <= gene_length(genome, nt->id)) {
+        return genome->genes[pos];
+    }
+
+    reserve_genes(genome, genome->total_size + 1);
+    memmove(genome->genes + pos + 1, genome->genes + pos,
+            (genome->total_size - pos) * sizeof(int));
+    genome->genes[pos] = genome->rnd() * nt->size;
+    genome->total_size++;
+    for (i = nt->id + 1; i < genome->n_genes; ++i) offset[i]++;
 
+    return genome->genes[pos];
+}
+
+
+
+static int gene_length(struct gges_sge_genome *genome, int i)
 {
-    int i, j;
-    int total, production_total;
-    struct gges_bnf_non_terminal *rhs;
+    if (i + 1 < genome->n_genes) {
+        return genome->gene_offset[i + 1] - genome->gene_offset[i];
+    } else {
+        return genome->total_size - genome->gene_offset[i];
+    }
+}
+
 
 
+/* makes room for at least size values in the genome, growing
+ * geometrically so that dynamic genomes are not reallocated on every
+ * new value */
+static void reserve_genes(struct gges_sge_genome *genome, int size)
+{
+    int *old;
+
+    if (genome->capacity >= size) return;
+
+    if (genome->capacity < 16) genome->capacity = 16;
+    while (genome->capacity < size) genome->capacity *= 2;
+
+    if (genome->borrowed) {
+        /* can't grow a row of a population matrix, so move out of
+         * it */
+        old = genome->genes;
+        genome->genes = ALLOC(genome->capacity, sizeof(int), false);
+        memcpy(genome->genes, old, genome->total_size * sizeof(int));
+        genome->borrowed = false;
+    } else {
+        genome->genes = REALLOC(genome->genes, genome->capacity, sizeof(int));
+    }
+}
+
+
+
+/* copies gene i of src onto the end of dest */
+static void append_gene(struct gges_sge_genome *dest,
+                        struct gges_sge_genome *src, int i)
+{
+    int length;
+
+    length = gene_length(src, i);
+    if (length > 0) {
+        reserve_genes(dest, dest->total_size + length);
+        memcpy(dest->genes + dest->total_size, src->genes + src->gene_offset[i],
+               length * sizeof(int));
+    }
+    dest->gene_offset[i] = dest->total_size;
+    dest->gene_size[i] = src->gene_size[i];
+    dest->total_size += length;
+}
+
+
+
+/* drops the values of a dynamic genome that were not used in the
+ * last mapping, so each gene is exactly as long as its gene_size */
+static void trim_genome(struct gges_sge_genome *genome)
+{
+    int i, total;
+
     total = 0;
-    for (i = 0; i < lhs->size; ++i) {
-        production_total = 0;
+    for (i = 0; i < genome->n_genes; ++i) {
+        memmove(genome->genes + total, genome->genes + genome->gene_offset[i],
+                genome->gene_size[i] * sizeof(int));
+        genome->gene_offset[i] = total;
+        total += genome->gene_size[i];
+    }
+    genome->total_size = total;
+}
 
-        for (j = 0; j < lhs->productions[i].size; ++j) {
-            if (lhs->productions[i].tokens[j].terminal) continue;
-            rhs = lhs->productions[i].tokens[j].nt;
 
-            if (rhs == nt) {
-                production_total++;
-            } else {
-                production_total += compute_gene_size(nt, rhs);
+
+/* true if gene i of b holds the same values as were expressed by
+ * gene i of a in its last mapping */
+static bool same_expression(struct gges_sge_genome *a,
+                            struct gges_sge_genome *b, int i)
+{
+    if (a->gene_size[i] == 0) return true;
+    if (gene_length(b, i) < a->gene_size[i]) return false;
+
+    return memcmp(a->genes + a->gene_offset[i], b->genes + b->gene_offset[i],
+                  a->gene_size[i] * sizeof(int)) == 0;
+}
+
+
+
+/* returns the ids of the non-terminals of an acyclic grammar, ordered
+ * so that every non-terminal comes after those used in its
+ * productions (i.e., a depth-first post-order, with an explicit stack
+ * as unrolled grammars can be very deep) */
+static int *topological_order(struct gges_bnf_grammar *g)
+{
+    int i, n, top, v;
+    int *order, *stack, *pos_p, *pos_t;
+    bool *seen;
+    struct gges_bnf_non_terminal *nt;
+    struct gges_bnf_production *p;
+    struct gges_bnf_token *t;
+
+    order = ALLOC(g->size, sizeof(int), false);
+    stack = ALLOC(g->size, sizeof(int), false);
+    pos_p = ALLOC(g->size, sizeof(int), true);
+    pos_t = ALLOC(g->size, sizeof(int), true);
+    seen = ALLOC(g->size, sizeof(bool), true);
+
+    n = 0;
+    for (i = 0; i < g->size; ++i) {
+        if (seen[i]) continue;
+
+        seen[i] = true;
+        top = 0;
+        stack[top++] = i;
+        while (top > 0) {
+            v = stack[top - 1];
+            nt = g->non_terminals + v;
+
+            if (pos_p[v] == nt->size) {
+                order[n++] = v;
+                top--;
+                continue;
+            }
+
+            p = nt->productions + pos_p[v];
+            if (pos_t[v] == p->size) {
+                pos_p[v]++;
+                pos_t[v] = 0;
+                continue;
+            }
+
+            t = p->tokens + pos_t[v]++;
+            if (t->terminal || seen[t->nt->id]) continue;
+
+            seen[t->nt->id] = true;
+            stack[top++] = t->nt->id;
+        }
+    }
+
+    free(seen);
+    free(pos_t);
+    free(pos_p);
+    free(stack);
+
+    return order;
+}
+
+
+
+/* fills expansions with the most times that nt can be expanded in a
+ * derivation from each non-terminal */
+static void compute_gene_sizes(struct gges_bnf_grammar *g, int *order,
+                               struct gges_bnf_non_terminal *nt,
+                               int *expansions)
+{
+    int i, j, k;
+    int total, production_total;
+    struct gges_bnf_non_terminal *lhs, *rhs;
+
+    for (i = 0; i < g->size; ++i) {
+        lhs = g->non_terminals + order[i];
+
+        total = 0;
+        for (j = 0; j < lhs->size; ++j) {
+            production_total = 0;
+
+            for (k = 0; k < lhs->productions[j].size; ++k) {
+                if (lhs->productions[j].tokens[k].terminal) continue;
+                rhs = lhs->productions[j].tokens[k].nt;
+
+                if (rhs == nt) {
+                    production_total++;
+                } else {
+                    production_total += expansions[rhs->id];
+                }
             }
+
+            if (production_total > total) total = production_total;
         }
 
-        if (production_total > total) total = production_total;
+        expansions[lhs->id] = total;
+    }
+}
+
+
+
+/* points the genome at the shared layout (or gives it gene offsets
+ * of its own, if layout is NULL), and makes sure that it has room for
+ * the size of n_genes genes */
+static void use_layout(struct gges_sge_genome *genome,
+                       struct gges_sge_layout *layout, int n_genes)
+{
+    if (genome->n_genes != n_genes) {
+        genome->gene_size = REALLOC(genome->gene_size, n_genes, sizeof(int));
+    }
+
+    if (layout != NULL) {
+        if (genome->layout != layout) {
+            if (genome->layout == NULL) free(genome->gene_offset);
+            gges_sge_release_layout(genome->layout);
+            layout->refs++;
+            genome->layout = layout;
+            genome->gene_offset = layout->gene_offset;
+        }
+    } else if (genome->layout != NULL) {
+        gges_sge_release_layout(genome->layout);
+        genome->layout = NULL;
+        genome->gene_offset = ALLOC(n_genes, sizeof(int), false);
+    } else if (genome->n_genes != n_genes) {
+        genome->gene_offset = REALLOC(genome->gene_offset, n_genes, sizeof(int));
     }
 
-    return total;
+    genome->n_genes = n_genes;
+}
+
+
+
+/* copies genome values [start, end) of the parents into the
+ * offspring, crossed over if swap is true */
+static void copy_block(struct gges_sge_genome *m,
+                       struct gges_sge_genome *f,
+                       struct gges_sge_genome *d,
+                       struct gges_sge_genome *s,
+                       int start, int end, bool swap)
+{
+    if (end == start) return;
+
+    if (swap) {
+        memcpy(d->genes + start, f->genes + start, (end - start) * sizeof(int));
+        memcpy(s->genes + start, m->genes + start, (end - start) * sizeof(int));
+    } else {
+        memcpy(d->genes + start, m->genes + start, (end - start) * sizeof(int));
+        memcpy(s->genes + start, f->genes + start, (end - start) * sizeof(int));
+    }
 }
 
 
@@ -415,15 +848,21 @@ static int compute_gene_size(struct gges_bnf_non_terminal *nt,
 static void ensure_correct_size(struct gges_sge_genome *genome,
                                 struct gges_sge_genome *base)
 {
-    if (genome->total_size != base->total_size) {
-        genome->total_size = base->total_size;
+    if (genome->capacity < base->total_size) {
+        if (genome->borrowed) {
+            genome->genes = NULL;
+            genome->borrowed = false;
+        }
+        genome->capacity = base->total_size;
         genome->genes = REALLOC(genome->genes, base->total_size, sizeof(int));
     }
-    if (genome->n_genes != base->n_genes) {
-        genome->n_genes = base->n_genes;
-        genome->gene_offset = REALLOC(genome->gene_offset, base->n_genes, sizeof(int));
-        memcpy(genome->gene_offset, base->gene_offset, base->n_genes * sizeof(int));
+    genome->total_size = base->total_size;
+    genome->rnd = base->rnd;
 
-        genome->gene_size = REALLOC(genome->gene_size, base->n_genes, sizeof(int));
+    use_layout(genome, base->layout, base->n_genes);
+
+    /* dynamic genomes each have their own gene offsets */
+    if (base->layout == NULL) {
+        memcpy(genome->gene_offset, base->gene_offset, base->n_genes * sizeof(int));
     }
 }
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <string.h>
+
+#include "grammar.h"
+
+/* checks that typed data fields (ERCs) survive a grammar being
+ * written to and loaded from a compiled grammar file, once their
+ * generators have been registered again on the loaded grammar */
+
+static double rnd(void)
+{
+    return 0.25;
+}
+
+static double real_field(double (*rnd)(void))
+{
+    return 4 * rnd() - 0.5;
+}
+
+static int int_field(double (*rnd)(void))
+{
+    return (int)(100 * rnd()) + 7;
+}
+
+static struct gges_bnf_token *find_field(struct gges_bnf_grammar *g, const char *key)
+{
+    int i, j, k;
+    struct gges_bnf_production *p;
+
+    for (i = 0; i < g->size; ++i) {
+        for (j = 0; j < g->non_terminals[i].size; ++j) {
+            p = g->non_terminals[i].productions + j;
+            for (k = 0; k < p->size; ++k) {
+                if (p->tokens[k].data_field && (strcmp(p->tokens[k].symbol, key) == 0)) {
+                    return p->tokens + k;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static bool check_fields(struct gges_bnf_grammar *g, const char *stage)
+{
+    char text[GGES_DATA_FIELD_TEXT_LEN];
+    struct gges_bnf_token *t;
+    struct gges_bnf_data_field field;
+    bool ok = true;
+
+    gges_register_double_field_generator(g, "real", real_field);
+    gges_register_int_field_generator(g, "int", int_field);
+
+    t = find_field(g, "real");
+    if (t == NULL) {
+        fprintf(stderr, "%s: no @real@ data field in the grammar\n", stage);
+        return false;
+    }
+    gges_bnf_init_data_field(g, t->symbol, &field, rnd);
+    if ((field.type != GGES_DATA_FIELD_DOUBLE) || (field.value.d != 0.5) ||
+        (strcmp(gges_bnf_data_field_text(&field, text), "0.5") != 0)) {
+        fprintf(stderr, "%s: @real@ gave the wrong value\n", stage);
+        ok = false;
+    }
+    gges_bnf_release_data_field(&field);
+
+    t = find_field(g, "int");
+    if (t == NULL) {
+        fprintf(stderr, "%s: no @int@ data field in the grammar\n", stage);
+        return false;
+    }
+    gges_bnf_init_data_field(g, t->symbol, &field, rnd);
+    if ((field.type != GGES_DATA_FIELD_INT) || (field.value.i != 32) ||
+        (strcmp(gges_bnf_data_field_text(&field, text), "32") != 0)) {
+        fprintf(stderr, "%s: @int@ gave the wrong value\n", stage);
+        ok = false;
+    }
+    gges_bnf_release_data_field(&field);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    char bnf_name[1024], cache_name[1024];
+    const char *dir;
+    bool ok;
+    FILE *f;
+    struct gges_bnf_grammar *g;
+
+    dir = (argc > 1) ? argv[1] : ".";
+    snprintf(bnf_name, sizeof(bnf_name), "%s/test_datafield.bnf", dir);
+    snprintf(cache_name, sizeof(cache_name), "%s/test_datafield.gc", dir);
+
+    f = fopen(bnf_name, "w");
+    if (f == NULL) {
+        fprintf(stderr, "could not write %s\n", bnf_name);
+        return EXIT_FAILURE;
+    }
+    fprintf(f, "<e> ::= <e> '+' <c> | <c>\n<c> ::= @real@ | @int@\n");
+    fclose(f);
+    remove(cache_name);
+
+    /* the first load parses the grammar and writes the cache */
+    g = gges_load_bnf_cached(bnf_name, cache_name);
+    ok = (g->image == NULL) && check_fields(g, "parsed");
+    gges_release_grammar(g);
+
+    /* the second load comes from the cache, which holds the data
+     * field tokens but not their generators */
+    g = gges_load_bnf_cached(bnf_name, cache_name);
+    if (g->image == NULL) {
+        fprintf(stderr, "the grammar was not loaded from the cache\n");
+        ok = false;
+    }
+    if (g->data_field_gen_n != 0) {
+        fprintf(stderr, "the cached grammar should not hold any generators\n");
+        ok = false;
+    }
+    ok = check_fields(g, "cached") && ok;
+    gges_release_grammar(g);
+
+    remove(cache_name);
+    remove(bnf_name);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <string.h>
+
+#include "grammar.h"
+#include "mapping.h"
+#include "ge.h"
+
+/* checks that a GE genome with its non-coding tail pruned still maps
+ * to the same phenotype, including when the derivation ends with
+ * expansions that have a single production (and so read no codon) */
+
+#define GENOMES 2000
+#define BUFFER_SZ 256
+
+static unsigned long state = 12345;
+
+static double rnd(void)
+{
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    return (double)((state >> 33) & 0x7fffffff) / 2147483648.0;
+}
+
+static bool map(struct gges_bnf_grammar *g, struct gges_ge_codon_list *list,
+                struct gges_mapping *m, int wraps)
+{
+    memset(m->buffer, '\0', m->sz);
+    m->l = 0;
+
+    return gges_ge_map_codons(g, list, m, wraps, 0);
+}
+
+int main(void)
+{
+    int i, n, wraps, pruned;
+    bool ok;
+    char *phenotype;
+    double slack;
+    struct gges_bnf_grammar *g;
+    struct gges_ge_codon_list *list;
+    struct gges_mapping m;
+
+    g = gges_parse_bnf("<s> ::= <e> <end>\n"
+                       "<e> ::= <e> '+' <v> | <v>\n"
+                       "<v> ::= x | y | <w>\n"
+                       "<w> ::= '(' <e> <close>\n"
+                       "<close> ::= ')'\n"
+                       "<end> ::= <semi>\n"
+                       "<semi> ::= ';'\n");
+
+    list = gges_ge_create_codon_list(gges_ge_codon_width(g, 0));
+    m.sz = BUFFER_SZ;
+    m.buffer = malloc(m.sz);
+    phenotype = NULL;
+
+    ok = true;
+    pruned = 0;
+    for (i = 0; ok && (i < GENOMES); ++i) {
+        gges_ge_random_init(list, 10 + (int)(rnd() * 40), rnd);
+        wraps = i % 2;
+        if (!map(g, list, &m, wraps)) continue;
+
+        free(phenotype);
+        phenotype = malloc(m.l + 1);
+        memcpy(phenotype, m.buffer, m.l + 1);
+
+        /* a slack of zero prunes as much of the tail as possible */
+        slack = (i % 3 == 0) ? 0 : 0.5 * rnd();
+        n = list->N;
+        gges_ge_prune_tail(list, slack);
+        if (list->N < n) pruned++;
+
+        if (!map(g, list, &m, wraps)) {
+            fprintf(stderr, "genome %d no longer maps after pruning to %d codons\n", i, list->N);
+            ok = false;
+        } else if (strcmp(phenotype, m.buffer) != 0) {
+            fprintf(stderr, "genome %d maps to '%s' after pruning, not '%s'\n",
+                    i, m.buffer, phenotype);
+            ok = false;
+        }
+    }
+
+    if (ok && (pruned == 0)) {
+        fprintf(stderr, "none of the genomes were pruned\n");
+        ok = false;
+    }
+
+    free(phenotype);
+    free(m.buffer);
+    gges_ge_release_codon_list(list);
+    gges_release_grammar(g);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}